@@ -4,6 +4,7 @@
 #include <iostream>
 #include <string>
 #include <vector>
+#include <atomic>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <unistd.h>
@@ -12,16 +13,23 @@
 #include "../common/thread_pools.hpp"
 #include "../common/parsing.hpp"
 #include "../common/handlers_http.hpp"
+#include "../common/socket_options.hpp"
+#include "../common/cpu_topology.hpp"
 
-#define MAX_THREADS 5 // Maximum number of worker threads
 #define PORT 8080
 #define BUFFER_SIZE 4096
 
+// Set by GET /stop: the accept loop ends, queued clients are still served
+static std::atomic<bool> stopping{false};
+
 // Function to handle a single client connection
-void handle_client(int client_socket, int server_socket)
+void handle_client(int client_socket, int server_socket, const SocketOptions &socket_options)
 {
     char buffer[BUFFER_SIZE];
-    int bytes_received = recv(client_socket, buffer, BUFFER_SIZE, 0);
+    rearm_quickack(client_socket, socket_options);
+    int bytes_received = recv(client_socket, buffer, BUFFER_SIZE - 1, 0);
+    if (bytes_received < 0)
+        bytes_received = 0;
     buffer[bytes_received] = '\0'; // Null-terminate the received data
 
     // Basic request parsing (very simplified)
@@ -41,8 +49,11 @@ void handle_client(int client_socket, int server_socket)
 
         if (response.empty())
         {
-            close(client_socket);
-            close(server_socket);
+            // Wake the blocked accept(), the pool finishes what is queued.
+            // Only the first /stop: the listening socket closes after the pool.
+            response = RESPONSE_STUB + "Stopping";
+            if (!stopping.exchange(true))
+                shutdown(server_socket, SHUT_RDWR);
         }
     }
     else
@@ -54,7 +65,7 @@ void handle_client(int client_socket, int server_socket)
 }
 
 // Function to start the server
-int start_server()
+int start_server(const SocketOptions &socket_options, const WorkerOptions &worker_options)
 {
     int server_socket, client_socket;
     struct sockaddr_in server_address, client_address;
@@ -68,6 +79,10 @@ int start_server()
         return 1;
     }
 
+    // Per listener tuning: defer accept, fast open, buffer sizes, busy poll
+    if (apply_listen_options(server_socket, socket_options) != 0)
+        return 1;
+
     // Prepare server address
     server_address.sin_family = AF_INET;
     server_address.sin_addr.s_addr = INADDR_ANY; // Listen on all available interfaces
@@ -89,33 +104,57 @@ int start_server()
 
     std::cout << "Server listening on port " << PORT << std::endl;
 
-    ThreadPool pool(MAX_THREADS);
-
-    while (true)
+    // The pool drains at the end of this block, before the listening socket
+    // closes: queued /stop tasks still use its descriptor
     {
-        client_address_len = sizeof(client_address);
-        client_socket = accept(server_socket, (struct sockaddr *)&client_address, &client_address_len);
-        if (client_socket < 0)
-        {
-            perror("Accepting connection failed");
-            return 13; // Or handle the error as needed
-        }
+        int max_threads = worker_options.workers > 0 ? worker_options.workers : default_worker_count();
+        ThreadPool pool(max_threads, worker_options.pin_workers ? available_cpus() : std::vector<int>(), true);
+        std::cout << "ThreadPool " << max_threads << " threads running." << std::endl;
 
-        std::cout << "Client connected: " << client_socket << std::endl;
+        if (worker_options.acceptor_cpu >= 0)
+            pin_current_thread({worker_options.acceptor_cpu});
 
-        // Handle client in a separate function (or thread/process for concurrency)
-        pool.enqueue([client_socket, server_socket]()
-                     {
-            handle_client(client_socket, server_socket);
-            close(client_socket); // Close the socket after handling
-            std::cout << "Client disconnected: " << client_socket << std::endl; });
+        while (!stopping)
+        {
+            client_address_len = sizeof(client_address);
+            client_socket = accept(server_socket, (struct sockaddr *)&client_address, &client_address_len);
+            if (client_socket < 0)
+            {
+                if (stopping)
+                    break;
+                perror("Accepting connection failed");
+                return 13; // Or handle the error as needed
+            }
+
+            std::cout << "Client connected: " << client_socket << std::endl;
+            apply_client_options(client_socket, socket_options);
+
+            // Handle client in a separate function (or thread/process for concurrency)
+            pool.enqueue([client_socket, server_socket, &socket_options]()
+                         {
+                handle_client(client_socket, server_socket, socket_options);
+                close(client_socket); // Close the socket after handling
+                std::cout << "Client disconnected: " << client_socket << std::endl; });
+        }
     }
 
     close(server_socket); // Server socket is usually kept open, but close it if needed
+    std::cout << "Stopped, queued clients served." << std::endl;
     return 0;
 }
 
-int main()
+int main(int argc, char *argv[])
 {
-    return start_server();
+    SocketOptions socket_options;
+    WorkerOptions worker_options;
+    for (int i = 1; i < argc; i++)
+    {
+        if (!parse_socket_option(argv[i], socket_options) && !parse_worker_option(argv[i], worker_options))
+        {
+            std::cerr << "Usage: " << argv[0] << " [options]\n"
+                      << socket_options_usage() << worker_options_usage();
+            return 1;
+        }
+    }
+    return start_server(socket_options, worker_options);
 }
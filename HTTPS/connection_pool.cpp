@@ -0,0 +1,191 @@
+#include "connection_pool.hpp"
+#include "../common/parsing.hpp"
+
+#include <cstdlib>
+#include <iterator>
+#include <functional>
+#include <thread>
+#include <openssl/crypto.h>
+
+ConnectionPool::ConnectionPool(SSL_CTX *ctx, size_t max_idle_ssl)
+    : ctx(ctx), max_idle_ssl(max_idle_ssl)
+{
+}
+
+ConnectionPool::~ConnectionPool()
+{
+    for (SSL *ssl : idle_ssl)
+        SSL_free(ssl);
+}
+
+SSL *ConnectionPool::acquire_ssl()
+{
+    if (idle_ssl.empty())
+        return SSL_new(ctx);
+
+    SSL *ssl = idle_ssl.back();
+    idle_ssl.pop_back();
+    idle_ssl_count = idle_ssl.size();
+    reused++;
+    return ssl;
+}
+
+void ConnectionPool::release_ssl(SSL *ssl)
+{
+    // SSL_clear keeps the object and its settings, drops the session state
+    if (idle_ssl.size() >= max_idle_ssl || SSL_clear(ssl) != 1)
+    {
+        SSL_free(ssl);
+        return;
+    }
+    idle_ssl.push_back(ssl);
+    idle_ssl_count = idle_ssl.size();
+}
+
+bool ConnectionPool::acquire_buffer(IoBuffer &buffer)
+{
+    if (buffer.data != nullptr)
+        return true;
+
+    if (slabs_with_free.empty())
+    {
+        // Allocated by the loop thread: on its NUMA node at first touch
+        char *memory = new (std::nothrow) char[IO_BUFFERS_PER_SLAB * IO_BUFFER_SIZE];
+        if (memory == nullptr)
+            return false;
+        Slab &slab = slabs[memory];
+        slab.memory.reset(memory);
+        for (size_t i = IO_BUFFERS_PER_SLAB; i > 0; i--)
+            slab.free_buffers.push_back(memory + (i - 1) * IO_BUFFER_SIZE);
+        slabs_with_free.insert(memory);
+        slab_count = slabs.size();
+        idle_slabs++;
+    }
+
+    Slab &slab = slabs[*slabs_with_free.begin()];
+    if (slab.free_buffers.size() == IO_BUFFERS_PER_SLAB)
+        idle_slabs--;
+    buffer.data = slab.free_buffers.back();
+    buffer.begin = buffer.end = 0;
+    slab.free_buffers.pop_back();
+    if (slab.free_buffers.empty())
+        slabs_with_free.erase(slabs_with_free.begin());
+    buffers_used++;
+    return true;
+}
+
+void ConnectionPool::release_buffer(IoBuffer &buffer, bool force)
+{
+    if (buffer.data == nullptr || (!buffer.empty() && !force))
+        return;
+
+    // The slab starting at or below the block
+    auto it = std::prev(slabs.upper_bound(buffer.data));
+    Slab &slab = it->second;
+    if (slab.free_buffers.empty())
+        slabs_with_free.insert(it->first);
+    slab.free_buffers.push_back(buffer.data);
+    buffer = IoBuffer();
+    buffers_used--;
+
+    if (slab.free_buffers.size() == IO_BUFFERS_PER_SLAB)
+    {
+        if (idle_slabs > 0)
+        {
+            slabs_with_free.erase(it->first);
+            slabs.erase(it);
+            slab_count = slabs.size();
+        }
+        else
+            idle_slabs++;
+    }
+}
+
+// OpenSSL heap accounting: a header before each block keeps its size.
+// Counters are striped by thread, every handshake allocates a lot.
+namespace
+{
+    constexpr size_t HEADER = 16; // Keeps the malloc alignment
+    constexpr size_t STRIPES = 16;
+
+    struct alignas(64) Stripe
+    {
+        std::atomic<long> bytes{0};
+    };
+    Stripe stripes[STRIPES];
+    bool tracking = false;
+
+    Stripe &stripe()
+    {
+        thread_local size_t index = std::hash<std::thread::id>()(std::this_thread::get_id()) % STRIPES;
+        return stripes[index];
+    }
+
+    void *tracked_malloc(size_t num, const char *, int)
+    {
+        char *block = static_cast<char *>(malloc(num + HEADER));
+        if (block == nullptr)
+            return nullptr;
+        *reinterpret_cast<size_t *>(block) = num;
+        stripe().bytes.fetch_add(num, std::memory_order_relaxed);
+        return block + HEADER;
+    }
+
+    void tracked_free(void *ptr, const char *, int)
+    {
+        if (ptr == nullptr)
+            return;
+        char *block = static_cast<char *>(ptr) - HEADER;
+        stripe().bytes.fetch_sub(*reinterpret_cast<size_t *>(block), std::memory_order_relaxed);
+        free(block);
+    }
+
+    void *tracked_realloc(void *ptr, size_t num, const char *file, int line)
+    {
+        if (ptr == nullptr)
+            return tracked_malloc(num, file, line);
+        if (num == 0)
+        {
+            tracked_free(ptr, file, line);
+            return nullptr;
+        }
+
+        char *block = static_cast<char *>(ptr) - HEADER;
+        size_t old_num = *reinterpret_cast<size_t *>(block);
+        block = static_cast<char *>(realloc(block, num + HEADER));
+        if (block == nullptr)
+            return nullptr;
+        *reinterpret_cast<size_t *>(block) = num;
+        stripe().bytes.fetch_add((long)num - (long)old_num, std::memory_order_relaxed);
+        return block + HEADER;
+    }
+}
+
+bool tls_memory_tracking()
+{
+    tracking = CRYPTO_set_mem_functions(tracked_malloc, tracked_realloc, tracked_free) == 1;
+    return tracking;
+}
+
+long tls_heap_bytes()
+{
+    if (!tracking)
+        return -1;
+    long bytes = 0;
+    for (auto &s : stripes)
+        bytes += s.bytes.load(std::memory_order_relaxed);
+    return bytes;
+}
+
+bool parse_connection_option(const std::string &arg, ConnectionOptions &options)
+{
+    return parse_int_arg(arg, "--max-connections", options.max_connections) ||
+           parse_int_arg(arg, "--ssl-pool", options.ssl_pool);
+}
+
+std::string connection_options_usage()
+{
+    return "Connection options (HTTPS):\n"
+           "\t--max-connections=<n>\tclose new connections above n, default: no limit\n"
+           "\t--ssl-pool=<n>\t\tcleared SSL objects kept per I/O thread, default: 256\n";
+}
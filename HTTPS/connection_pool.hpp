@@ -0,0 +1,93 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <set>
+#include <memory>
+#include <atomic>
+#include <cstddef>
+#include <openssl/ssl.h>
+
+#define IO_BUFFER_SIZE 16 * 1024 // Slab block, also the request head limit
+#define IO_BUFFERS_PER_SLAB 64
+
+// Memory limits for many idle TLS connections
+struct ConnectionOptions
+{
+    int max_connections = 0; // Close new connections above this count, 0: no limit
+    int ssl_pool = 256;      // Cleared SSL objects kept per event loop for new connections
+};
+
+// Received bytes of a connection in a slab block. The block is held only
+// while bytes are pending, an idle connection has none.
+struct IoBuffer
+{
+    char *data = nullptr;
+    size_t begin = 0;
+    size_t end = 0;
+
+    size_t size() const { return end - begin; }
+    bool empty() const { return begin == end; }
+    std::string_view view() const { return {data + begin, end - begin}; }
+    void consume(size_t n)
+    {
+        begin += n;
+        if (begin == end)
+            begin = end = 0;
+    }
+};
+
+// SSL objects and I/O buffers of one event loop. Used only from that loop
+// thread, so no locks; the counters are atomic for /metrics.
+class ConnectionPool
+{
+public:
+    ConnectionPool(SSL_CTX *ctx, size_t max_idle_ssl);
+    ~ConnectionPool();
+
+    // Cleared SSL object from the pool or a new one
+    SSL *acquire_ssl();
+    // SSL_clear it for the next connection, freed if the pool is full
+    void release_ssl(SSL *ssl);
+
+    // Give the buffer a slab block to read into, false if out of memory.
+    // Blocks come from the lowest slab with a free one, so the others empty out.
+    bool acquire_buffer(IoBuffer &buffer);
+    // Return the block once nothing is pending, force drops pending bytes.
+    // A slab with no block in use is freed, one is kept for the next burst.
+    void release_buffer(IoBuffer &buffer, bool force = false);
+
+    size_t ssl_pooled() const { return idle_ssl_count; }
+    unsigned long ssl_reused() const { return reused; }
+    size_t buffers_in_use() const { return buffers_used; }
+    size_t slab_bytes() const { return slab_count * IO_BUFFERS_PER_SLAB * IO_BUFFER_SIZE; }
+
+private:
+    SSL_CTX *ctx;
+    size_t max_idle_ssl;
+    std::vector<SSL *> idle_ssl;
+    struct Slab
+    {
+        std::unique_ptr<char[]> memory;
+        std::vector<char *> free_buffers;
+    };
+    std::map<char *, Slab> slabs;   // By address, to find the slab of a block
+    std::set<char *> slabs_with_free; // Slabs that have a free block, lowest first
+    size_t idle_slabs = 0;            // Slabs with every block free
+
+    std::atomic<size_t> idle_ssl_count{0};
+    std::atomic<unsigned long> reused{0};
+    std::atomic<size_t> buffers_used{0};
+    std::atomic<size_t> slab_count{0};
+};
+
+// Count OpenSSL heap use. Must run before the first OpenSSL call.
+bool tls_memory_tracking();
+// OpenSSL heap in use, -1 when tracking is off
+long tls_heap_bytes();
+
+// Parse one command line argument like "--max-connections=100000"
+bool parse_connection_option(const std::string &arg, ConnectionOptions &options);
+std::string connection_options_usage();
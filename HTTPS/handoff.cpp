@@ -0,0 +1,174 @@
+#include "handoff.hpp"
+#include "../common/parsing.hpp"
+
+#include <iostream>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <sched.h>
+
+#define HANDOFF_MAX_FDS 16
+
+static bool unix_address(const std::string &path, struct sockaddr_un &address)
+{
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path))
+    {
+        std::cerr << time_stamp() << " Handoff socket path too long: " << path << std::endl;
+        return false;
+    }
+    memcpy(address.sun_path, path.c_str(), path.size());
+    return true;
+}
+
+int handoff_listen(const std::string &path)
+{
+    struct sockaddr_un address;
+    if (!unix_address(path, address))
+        return -1;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        perror((time_stamp() + " Handoff socket creation failed").c_str());
+        return -1;
+    }
+    unlink(path.c_str()); // Left by an earlier process, or owned by the one we took over from
+    if (bind(fd, (struct sockaddr *)&address, sizeof(address)) < 0 || listen(fd, 1) < 0)
+    {
+        perror((time_stamp() + " Handoff socket bind failed").c_str());
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool handoff_send(int conn, const std::vector<int> &fds)
+{
+    if (fds.empty() || fds.size() > HANDOFF_MAX_FDS)
+        return false;
+
+    // One byte of data carries the descriptors, their count is the byte
+    char count = (char)fds.size();
+    struct iovec iov = {&count, 1};
+    char control[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_FDS)] = {};
+    struct msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * fds.size());
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+    memcpy(CMSG_DATA(cmsg), fds.data(), sizeof(int) * fds.size());
+
+    if (sendmsg(conn, &msg, MSG_NOSIGNAL) != 1)
+    {
+        perror((time_stamp() + " Handoff send failed").c_str());
+        return false;
+    }
+    return true;
+}
+
+std::vector<int> handoff_receive(const std::string &path, int &conn)
+{
+    std::vector<int> fds;
+    struct sockaddr_un address;
+    if (!unix_address(path, address))
+        return fds;
+
+    conn = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (conn < 0 || connect(conn, (struct sockaddr *)&address, sizeof(address)) < 0)
+    {
+        perror((time_stamp() + " Handoff connect failed").c_str());
+        return fds;
+    }
+
+    char count = 0;
+    struct iovec iov = {&count, 1};
+    char control[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_FDS)] = {};
+    struct msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    if (recvmsg(conn, &msg, MSG_CMSG_CLOEXEC) != 1)
+    {
+        perror((time_stamp() + " Handoff receive failed").c_str());
+        return fds;
+    }
+
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+            continue;
+        size_t n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        fds.resize(n);
+        memcpy(fds.data(), CMSG_DATA(cmsg), sizeof(int) * n);
+    }
+    if (fds.size() != (size_t)count)
+        std::cerr << time_stamp() << " Handoff: expected " << (int)count << " sockets, got " << fds.size() << std::endl;
+    return fds;
+}
+
+bool handoff_ready(int conn)
+{
+    bool sent = send(conn, "R", 1, MSG_NOSIGNAL) == 1;
+    close(conn);
+    return sent;
+}
+
+int spawn_upgrade(const std::vector<std::string> &argv, const std::string &path, const std::vector<int> &cpus)
+{
+    std::vector<std::string> args;
+    for (const std::string &arg : argv)
+        if (arg.compare(0, 11, "--takeover=") != 0)
+            args.push_back(arg);
+    args.push_back("--takeover=" + path);
+
+    std::vector<char *> exec_argv;
+    for (std::string &arg : args)
+        exec_argv.push_back(arg.data());
+    exec_argv.push_back(nullptr);
+
+    // The calling thread may be pinned, the new process gets the whole set back
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus)
+        CPU_SET(cpu, &set);
+
+    // Fork and exec at once, the child runs the binary now on disk
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        perror((time_stamp() + " Upgrade fork failed").c_str());
+        return -1;
+    }
+    if (pid == 0)
+    {
+        if (!cpus.empty())
+            sched_setaffinity(0, sizeof(set), &set);
+        execvp(exec_argv[0], exec_argv.data());
+        _exit(127);
+    }
+    return pid;
+}
+
+bool parse_shutdown_option(const std::string &arg, ShutdownOptions &options)
+{
+    return parse_int_arg(arg, "--drain-timeout", options.drain_timeout_ms) ||
+           parse_string_arg(arg, "--upgrade-socket", options.upgrade_socket) ||
+           parse_string_arg(arg, "--takeover", options.takeover);
+}
+
+std::string shutdown_options_usage()
+{
+    return "Shutdown options (HTTPS):\n"
+           "\t--drain-timeout=<ms>\ttime to finish requests on SIGINT, SIGTERM or GET /stop, default: 10000\n"
+           "\t--upgrade-socket=<path>\taccept hot upgrades here, SIGUSR2 starts the binary again to take over\n"
+           "\t--takeover=<path>\tstart with the listening sockets of the server at path\n";
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Hot upgrade: the running server passes its listening sockets to a new
+// process over a UNIX socket (SCM_RIGHTS). Both accept on the same sockets
+// until the new one reports ready, then the old one drains. No SYN is
+// dropped, the listening sockets are never closed.
+//
+//  old: handoff_listen(path)  ... accept, handoff_send(listeners), wait for ready
+//  new: handoff_receive(path) ... open the worker threads, handoff_ready()
+
+// UNIX socket for upgrade requests, -1 on error. A stale socket file is replaced.
+int handoff_listen(const std::string &path);
+// Send the listening sockets to a connected new process
+bool handoff_send(int conn, const std::vector<int> &fds);
+// Connect to the running server and take over its listening sockets.
+// conn stays open to report ready. Empty on error.
+std::vector<int> handoff_receive(const std::string &path, int &conn);
+// Tell the old process the new one accepts, it then drains
+bool handoff_ready(int conn);
+
+// Start a new instance of this binary taking over through path, on the
+// given CPUs. Its pid, -1 on error.
+int spawn_upgrade(const std::vector<std::string> &argv, const std::string &path, const std::vector<int> &cpus);
+
+// Shutdown and upgrade behaviour of the server
+struct ShutdownOptions
+{
+    int drain_timeout_ms = 10000;     // In-flight and keep-alive requests get this long, then connections are cut
+    std::string upgrade_socket;       // Serve hot upgrades on this UNIX socket, empty: off
+    std::string takeover;             // Start with the listening sockets of the server at this path
+    std::vector<std::string> command; // argv to start the upgraded binary with
+};
+
+// Parse one command line argument like "--drain-timeout=5000"
+bool parse_shutdown_option(const std::string &arg, ShutdownOptions &options);
+std::string shutdown_options_usage();
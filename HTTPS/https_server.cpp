@@ -1,10 +1,40 @@
 #include "https_server.hpp"
-// Global variable to control server loop
-volatile sig_atomic_t running = 1;
 
-HTTPS_SERVER::HTTPS_SERVER(int port, int max_threads, std::string log_file_base) : port(port), max_threads(max_threads), log_file_base(log_file_base)
+#include <sys/epoll.h>
+#include <sys/wait.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <cstring>
+#include <cstdio>
+#include <filesystem>
+
+// Highest NNN of the server_log_NNN.txt files in the folder, -1 if none
+static int last_log_index(const std::string &log_file_base)
+{
+    int last = -1;
+    std::error_code error;
+    for (const auto &entry : std::filesystem::directory_iterator(log_file_base, error))
+    {
+        const std::string name = entry.path().filename().string();
+        int index = -1;
+        if (sscanf(name.c_str(), "server_log_%d.txt", &index) == 1 && index > last)
+            last = index;
+    }
+    return last;
+}
+
+HTTPS_SERVER::HTTPS_SERVER(int port, const WorkerOptions &worker_options, std::string log_file_base, const SocketOptions &socket_options,
+                           const ConnectionOptions &connection_options, const TlsOptions &tls_options,
+                           const ShutdownOptions &shutdown_options)
+    : port(port), worker_options(worker_options), socket_options(socket_options), connection_options(connection_options),
+      tls_options(tls_options), shutdown_options(shutdown_options), log_file_base(log_file_base)
 {
-    log_file_index = 0;
+    // Signal handlers and handlers of other threads write commands here
+    if (pipe2(command_pipe, O_CLOEXEC | O_NONBLOCK) < 0)
+        perror((time_stamp() + " Command pipe not created").c_str());
+
+    // A process taking over starts a new segment, the old one still writes its current one
+    log_file_index = shutdown_options.takeover.empty() ? 0 : last_log_index(log_file_base) + 1;
     std::ostringstream log_file_name;
     log_file_name << log_file_base << "/server_log_" << std::setw(3) << std::setfill('0') << log_file_index << ".txt";
 
@@ -23,14 +53,23 @@ HTTPS_SERVER::HTTPS_SERVER(int port, int max_threads, std::string log_file_base)
 HTTPS_SERVER::~HTTPS_SERVER()
 {
     close(server_socket);
+    close(command_pipe[0]);
+    close(command_pipe[1]);
+
+    // Compute pools first, their last tasks post results to the loops
+    for (auto &group : groups)
+        delete group.compute;
+    for (auto &group : groups)
+        for (auto loop : group.loops)
+            delete loop;
+    for (auto &group : groups)
+        for (auto pool : group.pools)
+            delete pool;
 
     // Cleanup OpenSSL
     EVP_cleanup();
     SSL_CTX_free(ctx);
 
-    // ThreadPool
-    delete pool;
-
     if (log_file != nullptr && log_file->is_open())
     {
         log_file->close();
@@ -58,28 +97,20 @@ SSL_CTX *HTTPS_SERVER::create_context()
 // Configure SSL context
 void HTTPS_SERVER::configure_context(SSL_CTX *ctx)
 {
-    SSL_CTX_set_ecdh_auto(ctx, 1);
-
-    // Set the certificate and key
-    if (SSL_CTX_use_certificate_file(ctx, "server.crt", SSL_FILETYPE_PEM) <= 0)
-    {
-        perror((time_stamp() + " Error loading certificate").c_str());
-        ERR_print_errors_fp(stderr);
-        exit(EXIT_FAILURE);
-    }
+    // Free the 34 KB of record buffers whenever they are drained: an idle
+    // keep-alive connection then holds no buffer at all
+    SSL_CTX_set_mode(ctx, SSL_MODE_RELEASE_BUFFERS);
 
-    if (SSL_CTX_use_PrivateKey_file(ctx, "server.key", SSL_FILETYPE_PEM) <= 0)
-    {
-        perror((time_stamp() + " Error loading private key").c_str());
-        ERR_print_errors_fp(stderr);
+    // Protocol versions, ciphers, groups, certificates and keys
+    if (configure_tls(ctx, tls_options) != 0)
         exit(EXIT_FAILURE);
-    }
+    std::cout << time_stamp() << " " << tls_summary(tls_options) << std::endl;
 }
 
-int HTTPS_SERVER::open()
+int HTTPS_SERVER::create_listener()
 {
     // Create socket
-    server_socket = socket(AF_INET, SOCK_STREAM, 0);
+    server_socket = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
     if (server_socket < 0)
     {
         perror((time_stamp() + " Socket creation failed").c_str());
@@ -93,6 +124,10 @@ int HTTPS_SERVER::open()
         return 1;
     }
 
+    // Per listener tuning: defer accept, fast open, buffer sizes, busy poll
+    if (apply_listen_options(server_socket, socket_options) != 0)
+        return 1;
+
     // Prepare server address
     server_address.sin_family = AF_INET;
     server_address.sin_addr.s_addr = INADDR_ANY;
@@ -113,143 +148,1025 @@ int HTTPS_SERVER::open()
     }
 
     std::cout << time_stamp() << " Server listening on port " << port << std::endl;
+    return 0;
+}
+
+int HTTPS_SERVER::open()
+{
+    int state = 0;
+    if (!shutdown_options.takeover.empty())
+    {
+        // Hot upgrade: the socket of the running server, bound and listening
+        std::vector<int> fds = handoff_receive(shutdown_options.takeover, takeover_conn);
+        if (fds.empty())
+            return 1;
+        server_socket = fds[0];
+        for (size_t i = 1; i < fds.size(); i++)
+            close(fds[i]);
+        std::cout << time_stamp() << " Took over the listening socket on port " << port << std::endl;
+    }
+    else if ((state = create_listener()) != 0)
+        return state;
 
-    this->pool = new ThreadPool(max_threads);
-    std::cout << time_stamp() << " ThreadPool " << max_threads << " threads running." << std::endl;
+    // Polled along with the commands. During an upgrade two processes accept
+    // from it, so accept() must not block when the other one was faster.
+    fcntl(server_socket, F_SETFL, fcntl(server_socket, F_GETFL) | O_NONBLOCK);
+
+    // Worker groups: the whole affinity mask, or one group per NUMA node
+    max_threads = worker_options.workers > 0 ? worker_options.workers : default_worker_count();
+    io_threads = worker_options.io_threads > 0 ? worker_options.io_threads : max_threads;
+    std::vector<int> cpus = available_cpus();
+    process_cpus = cpus;
+    std::vector<std::vector<int>> group_cpus;
+    if (worker_options.numa)
+        group_cpus = numa_groups(cpus);
+    else
+        group_cpus.push_back(cpus);
+
+    cpu_group.assign(cpus.back() + 1, -1);
+    bool pinned = worker_options.numa || worker_options.pin_workers;
+    groups.resize(group_cpus.size());
+    for (size_t g = 0; g < group_cpus.size(); g++)
+    {
+        const std::vector<int> &node = group_cpus[g];
+        size_t threads = std::max<size_t>(1, max_threads * node.size() / cpus.size());
+        size_t loops = std::max<size_t>(1, io_threads * node.size() / cpus.size());
+        for (int cpu : node)
+            cpu_group[cpu] = g;
+
+        for (size_t i = 0; i < loops; i++)
+        {
+            std::vector<int> loop_cpus;
+            if (worker_options.pin_workers)
+                loop_cpus = {node[i % node.size()]};
+            else if (pinned)
+                loop_cpus = node;
+            EventLoop *loop = new EventLoop(loop_cpus);
+            std::string name = "io " + std::to_string(g) + "." + std::to_string(i);
+            loop->post([name]
+                       { trace_thread_name(name); });
+            groups[g].loops.push_back(loop);
+            groups[g].pools.push_back(new ConnectionPool(ctx, std::max(0, connection_options.ssl_pool)));
+            groups[g].open.emplace_back();
+        }
+
+        if (pinned)
+            groups[g].compute = new ThreadPool(threads, node, worker_options.pin_workers);
+        else
+            groups[g].compute = new ThreadPool(threads);
+        std::cout << time_stamp() << " " << loops << " I/O threads, ThreadPool " << threads << " threads running"
+                  << (pinned ? " on node " + std::to_string(cpu_numa_node(node.front())) : "") << "." << std::endl;
+    }
 
     return 0;
 }
 
+// Worker group of the NUMA node that received the connection, round robin otherwise
+size_t HTTPS_SERVER::pick_group(int client_socket)
+{
+    if (groups.size() == 1)
+        return 0;
+
+    int cpu = socket_incoming_cpu(client_socket);
+    if (cpu >= 0 && cpu < (int)cpu_group.size() && cpu_group[cpu] >= 0)
+        return cpu_group[cpu];
+    return next_group++ % groups.size();
+}
+
 void HTTPS_SERVER::run()
 {
-    while (running)
+    if (worker_options.acceptor_cpu >= 0)
+        pin_current_thread({worker_options.acceptor_cpu});
+    trace_thread_name("acceptor");
+
+    // Taken over: the loops are up, the old process can drain now
+    if (takeover_conn >= 0)
     {
-        struct sockaddr_in client_address;
-        socklen_t client_address_len = sizeof(client_address);
-        int client_socket = accept(server_socket, (struct sockaddr *)&client_address, &client_address_len);
+        handoff_ready(takeover_conn);
+        takeover_conn = -1;
+    }
+    if (!shutdown_options.upgrade_socket.empty())
+        handoff_socket = handoff_listen(shutdown_options.upgrade_socket);
 
-        if (client_socket < 0)
+    bool drain_now = false, upgraded = false;
+    while (!drain_now)
+    {
+        struct pollfd fds[4] = {{server_socket, POLLIN, 0},
+                                {command_pipe[0], POLLIN, 0},
+                                {handoff_socket, POLLIN, 0},
+                                {handoff_conn, POLLIN, 0}};
+        // While an upgrade runs, wake up now and then to reap it if it died
+        if (poll(fds, 4, upgrade_pid > 0 ? UPGRADE_POLL_MS : -1) < 0)
         {
             if (errno == EINTR)
-            { // Handle interrupted system call
-                std::cout << time_stamp() << " Accept interrupted by signal. Continuing..." << std::endl;
-                continue; // Go back to the beginning of the loop
-            }
-            else
+                continue; // Signal, its command is in the pipe
+            perror((time_stamp() + " Poll failed").c_str());
+            break;
+        }
+
+        if (fds[0].revents & POLLIN)
+            accept_connections();
+        if (fds[2].revents & POLLIN)
+            handoff_request();
+        if (fds[3].revents & (POLLIN | POLLHUP))
+            drain_now = upgraded = handoff_answer();
+        if (upgrade_pid > 0)
+            reap_upgrade();
+        if (fds[1].revents & POLLIN)
+        {
+            char commands[16];
+            ssize_t n = read(command_pipe[0], commands, sizeof(commands));
+            for (ssize_t i = 0; i < n; i++)
             {
-                perror((time_stamp() + " Accepting connection failed").c_str());
-                break; // Or handle the error as appropriate
+                if (commands[i] == COMMAND_DRAIN)
+                    drain_now = true;
+                else if (commands[i] == COMMAND_UPGRADE)
+                    start_upgrade();
             }
         }
+    }
 
-        SSL *ssl = SSL_new(ctx);
-        SSL_set_fd(ssl, client_socket);
+    drain(upgraded);
+}
 
-        if (SSL_accept(ssl) <= 0)
+void HTTPS_SERVER::command(ServerCommand command)
+{
+    char c = command;
+    if (write(command_pipe[1], &c, 1) < 0)
+    {
+        // Pipe full: commands are already waiting
+    }
+}
+
+// Accept until the queue is empty
+void HTTPS_SERVER::accept_connections()
+{
+    while (true)
+    {
+        struct sockaddr_in client_address;
+        socklen_t client_address_len = sizeof(client_address);
+        int client_socket = accept4(server_socket, (struct sockaddr *)&client_address, &client_address_len,
+                                    SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+        if (client_socket < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                perror((time_stamp() + " Accepting connection failed").c_str());
+            return; // Queue empty, or taken by the other process during an upgrade
+        }
+
+        // Bounded footprint: over the limit the connection is closed at once
+        if (connection_options.max_connections > 0 && connections_open >= connection_options.max_connections)
         {
-            perror((time_stamp() + " SSL accept error").c_str());
-            ERR_print_errors_fp(stderr);
             close(client_socket);
-            SSL_free(ssl);
+            connections_rejected++;
             continue;
         }
+        connections_open++;
+
+        RequestTrace trace;
+        trace.start();
+
+        apply_client_options(client_socket, socket_options);
 
-        pool->enqueue(
-            [ssl, this]()
+        // The connection stays on one event loop of its group until it is closed
+        WorkerGroup *group = &groups[pick_group(client_socket)];
+        size_t loop_index = group->next_loop++ % group->loops.size();
+        trace.mark(PHASE_ACCEPT);
+        group->loops[loop_index]->post(
+            [this, group, loop_index, client_socket, trace]()
             {
-                handle_client(ssl);
+                start_connection(group, loop_index, client_socket, trace);
             });
     }
 }
 
-// Handle requests
-void HTTPS_SERVER::handle_client(SSL *ssl)
+// SIGUSR2: start this binary again, it takes the listening socket over the handoff socket
+void HTTPS_SERVER::start_upgrade()
 {
-    char buffer[BUFFER_SIZE] = {0};
-    int bytes_received = SSL_read(ssl, buffer, sizeof(buffer));
+    if (handoff_socket < 0)
+    {
+        std::cerr << time_stamp() << " Upgrade needs --upgrade-socket." << std::endl;
+        return;
+    }
+    if (handoff_conn >= 0 || upgrade_pid > 0)
+    {
+        std::cerr << time_stamp() << " Upgrade already running." << std::endl;
+        return;
+    }
 
-    if (bytes_received < 0)
-    { // Check for errors
-        perror((time_stamp() + " SSL read error").c_str());
-        ERR_print_errors_fp(stderr);
+    int pid = spawn_upgrade(shutdown_options.command, shutdown_options.upgrade_socket, process_cpus);
+    if (pid > 0)
+    {
+        upgrade_pid = pid;
+        std::cout << time_stamp() << " Upgrade: started process " << pid << std::endl;
+    }
+}
+
+// A new process asks for the listening socket. Both accept until it is ready.
+void HTTPS_SERVER::handoff_request()
+{
+    int conn = accept4(handoff_socket, nullptr, nullptr, SOCK_CLOEXEC);
+    if (conn < 0)
+        return;
+    if (handoff_conn >= 0 || !handoff_send(conn, {server_socket}))
+    {
+        close(conn);
         return;
     }
-    else if (bytes_received == 0)
-    { // Client disconnected
-        std::cout << "Client disconnected." << std::endl;
+    handoff_conn = conn;
+    log_rotation = false; // The new process opens the next segments
+    std::cout << time_stamp() << " Upgrade: listening socket sent" << std::endl;
+}
+
+// True when the new process is ready, false if it went away before
+bool HTTPS_SERVER::handoff_answer()
+{
+    char answer = 0;
+    bool ready = read(handoff_conn, &answer, 1) == 1 && answer == 'R';
+    close(handoff_conn);
+    handoff_conn = -1;
+    if (ready)
+    {
+        upgrade_pid = -1; // It serves on, we exit
+        std::cout << time_stamp() << " Upgrade: new process accepting, draining." << std::endl;
+    }
+    else
+    {
+        std::cerr << time_stamp() << " Upgrade failed, still serving." << std::endl;
+        log_rotation = true;
+    }
+    return ready;
+}
+
+// The new process exited before it was ready: abort the upgrade, this
+// process keeps serving and writing the log
+void HTTPS_SERVER::reap_upgrade()
+{
+    int status = 0;
+    if (waitpid(upgrade_pid, &status, WNOHANG) != upgrade_pid)
         return;
+    std::cerr << time_stamp() << " Upgrade: process " << upgrade_pid << " exited with "
+              << (WIFSIGNALED(status) ? "signal " + std::to_string(WTERMSIG(status)) : "status " + std::to_string(WEXITSTATUS(status)))
+              << ", still serving." << std::endl;
+    upgrade_pid = -1;
+    if (handoff_conn >= 0)
+    {
+        close(handoff_conn);
+        handoff_conn = -1;
     }
+    log_rotation = true;
+}
+
+// Stop accepting, let the connections finish their requests until the
+// deadline, cut the rest and flush the log
+void HTTPS_SERVER::drain(bool upgraded)
+{
+    draining = true;
+    // After an upgrade the new process owns the socket file and the listening socket
+    if (handoff_socket >= 0)
+    {
+        close(handoff_socket);
+        if (!upgraded)
+            unlink(shutdown_options.upgrade_socket.c_str());
+    }
+    close(server_socket);
+    server_socket = -1;
 
-    // Basic request parsing (very simplified)
-    std::string request(buffer, bytes_received); // Use bytes_received for correct string length
-    std::string response;
-    std::vector<std::string> tokens = split(request); // Assuming 'split' is defined elsewhere
+    std::cout << time_stamp() << " Draining " << connections_open << " connections, up to "
+              << shutdown_options.drain_timeout_ms << " ms." << std::endl;
+    for (auto &group : groups)
+        for (size_t i = 0; i < group.loops.size(); i++)
+            group.loops[i]->post([this, &group, i]()
+                                 { drain_loop(&group, i, false); });
 
-    int response_status = 200;                                   // Default response status
-    auto start_time = std::chrono::high_resolution_clock::now(); // Start time for response time calculation
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(shutdown_options.drain_timeout_ms);
+    while (connections_open > 0 && std::chrono::steady_clock::now() < deadline)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
 
-    if (tokens.size() > 2)
+    if (connections_open > 0)
     {
-        const std::string &method = tokens[0];
-        if (method == "get")
-            response = GET_handler(tokens); // Assuming GET_handler is defined elsewhere
-        else if (method == "post")
-            response = POST_handler(tokens); // Assuming POST_handler is defined elsewhere
+        std::cerr << time_stamp() << " Drain deadline: cutting " << connections_open << " connections." << std::endl;
+        for (auto &group : groups)
+            for (size_t i = 0; i < group.loops.size(); i++)
+                group.loops[i]->post([this, &group, i]()
+                                     { drain_loop(&group, i, true); });
+        // Handlers waiting for I/O fail and finish, others are abandoned
+        auto cut_deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(100);
+        while (connections_open > 0 && std::chrono::steady_clock::now() < cut_deadline)
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    trace_dump();
+    std::lock_guard<std::mutex> guard(log_mutex);
+    if (log_file != nullptr)
+        log_file->flush();
+    std::cout << time_stamp() << " Drained." << std::endl;
+}
+
+// Runs on the loop. Idle keep-alive connections get a short grace for one
+// more request, responses carry Connection: close. cut closes what is left.
+void HTTPS_SERVER::drain_loop(WorkerGroup *group, size_t loop_index, bool cut)
+{
+    std::vector<Connection *> conns(group->open[loop_index].begin(), group->open[loop_index].end());
+    for (Connection *conn : conns)
+    {
+        if (!cut)
+        {
+            if ((conn->state == Connection::READING && conn->in.empty()) || conn->state == Connection::HANDSHAKE)
+                arm_idle_timer(conn, DRAIN_IDLE_MS);
+        }
+        else if (conn->state != Connection::HANDLING)
+            close_connection(conn);
         else
         {
-            response = NOT_IMPLEMENTED; // Assuming NOT_IMPLEMENTED is defined elsewhere
-            response_status = 501;      // Not Implemented
+            // The handler's reads and writes fail, it finishes and closes
+            conn->broken = true;
+            shutdown(conn->fd, SHUT_RDWR);
         }
+    }
+}
+
+void HTTPS_SERVER::start_connection(WorkerGroup *group, size_t loop_index, int client_socket, const RequestTrace &trace)
+{
+    Connection *conn = new Connection();
+    conn->server = this;
+    conn->fd = client_socket;
+    conn->group = group;
+    conn->loop = group->loops[loop_index];
+    conn->loop_index = loop_index;
+    conn->pool = group->pools[loop_index];
+    group->open[loop_index].insert(conn);
+    conn->trace = trace;
+    conn->trace.mark(PHASE_QUEUE);
+
+    // Taken on the loop thread, so the SSL object lives on the node that serves it
+    conn->ssl = conn->pool->acquire_ssl();
+    SSL_set_fd(conn->ssl, client_socket);
+    account(conn);
+
+    watch(conn, EPOLLIN);
+    arm_idle_timer(conn, draining ? DRAIN_IDLE_MS : IDLE_TIMEOUT_MS);
+    do_handshake(conn);
+}
+
+void HTTPS_SERVER::on_event(Connection *conn)
+{
+    switch (conn->state)
+    {
+    case Connection::HANDSHAKE:
+        do_handshake(conn);
+        break;
+    case Connection::READING:
+        do_read(conn);
+        break;
+    case Connection::WRITING:
+        do_write(conn);
+        break;
+    case Connection::HANDLING:
+        handler_io(conn);
+        break;
+    }
+}
+
+// Heap bytes of a string, 0 while it fits the small string buffer
+static size_t string_heap(const std::string &s)
+{
+    return s.capacity() > std::string().capacity() ? s.capacity() + 1 : 0;
+}
+
+// clear() keeps the capacity, swapping with an empty string frees it
+static void release_string(std::string &s)
+{
+    std::string().swap(s);
+}
+
+// Wait for the socket state OpenSSL asked for, false if the error is fatal.
+// SSL_get_error reads the thread's error queue: clear it before every
+// SSL_accept, SSL_read, SSL_write and SSL_shutdown, the loop serves many connections.
+static bool want_io(SSL *ssl, int ret, uint32_t &events)
+{
+    switch (SSL_get_error(ssl, ret))
+    {
+    case SSL_ERROR_WANT_READ:
+        events = EPOLLIN;
+        return true;
+    case SSL_ERROR_WANT_WRITE:
+        events = EPOLLOUT;
+        return true;
+    default:
+        return false;
+    }
+}
+
+void HTTPS_SERVER::do_handshake(Connection *conn)
+{
+    ERR_clear_error();
+    int ret = SSL_accept(conn->ssl);
+    if (ret == 1)
+    {
+        conn->trace.mark(PHASE_HANDSHAKE);
+        conn->state = Connection::READING;
+        do_read(conn);
+        return;
+    }
+
+    uint32_t events;
+    if (want_io(conn->ssl, ret, events))
+    {
+        watch(conn, events);
+        return;
+    }
+    std::cerr << time_stamp() << " SSL accept error" << std::endl;
+    ERR_print_errors_fp(stderr);
+    close_connection(conn);
+}
+
+// SSL_read into the connection's slab buffer, ret is the SSL_read result.
+// False when the buffer is full of an unfinished head or no block is left.
+bool HTTPS_SERVER::read_some(Connection *conn, int &ret)
+{
+    IoBuffer &in = conn->in;
+    if (!conn->pool->acquire_buffer(in))
+        return false;
+    if (in.end == IO_BUFFER_SIZE)
+    {
+        if (in.begin == 0)
+            return false;
+        memmove(in.data, in.data + in.begin, in.size());
+        in.end -= in.begin;
+        in.begin = 0;
+    }
+
+    ERR_clear_error();
+    ret = SSL_read(conn->ssl, in.data + in.end, IO_BUFFER_SIZE - in.end);
+    if (ret > 0)
+        in.end += ret;
+    else
+        conn->pool->release_buffer(in); // Back to the slab while the connection idles
+    return true;
+}
+
+void HTTPS_SERVER::do_read(Connection *conn)
+{
+    rearm_quickack(conn->fd, socket_options);
 
-        if (response.empty())
+    // Read until the head is complete, the body is left to the handler. Level
+    // triggered epoll does not report data OpenSSL already decrypted, so read
+    // until OpenSSL asks for the socket.
+    while (head_length(conn->in.view()) == 0)
+    {
+        int bytes_received = 0;
+        if (!read_some(conn, bytes_received))
         {
-            // Log the request and response along with client details
-            log_request_response(ssl, request, response_status, start_time);
-
-            std::cerr << time_stamp() << " Remote command: stop. Shutting down server." << std::endl;
-            SSL_shutdown(ssl);
-            SSL_free(ssl);
-            close(SSL_get_fd(ssl)); // Close the socket
-            exit(13);               // Exit the application immediately
+            head_too_large(conn);
+            return;
+        }
+        if (bytes_received <= 0)
+        {
+            uint32_t events;
+            if (want_io(conn->ssl, bytes_received, events))
+                watch(conn, events);
+            else
+                close_connection(conn); // Client disconnected or read error
+            return;
         }
+
+        if (conn->trace.marks[0] == 0)
+            conn->trace.start(); // Keep-alive request: starts with its first bytes
+    }
+
+    if (conn->trace.marks[0] == 0)
+        conn->trace.start(); // Pipelined request, already buffered
+    dispatch(conn, head_length(conn->in.view()));
+}
+
+// A head that does not fit the read buffer: answer 431 like the 413 for
+// bodies, then close, the rest of the request is not read
+void HTTPS_SERVER::head_too_large(Connection *conn)
+{
+    std::cerr << time_stamp() << " Request head too large, closing." << std::endl;
+    conn->loop->cancel_timer(conn->timer);
+    conn->timer = 0;
+    if (conn->trace.marks[0] == 0)
+        conn->trace.start();
+    std::string_view head = conn->in.view();
+    conn->request.assign(head.substr(0, std::min(head.find("\r\n"), (size_t)256))); // Request line for the log
+    conn->body_remaining = 0;
+    conn->keep_alive = false;
+    conn->state = Connection::HANDLING;
+    finish_request(conn, Response{431, "HTTP/1.1 431 Request Header Fields Too Large\r\nContent-Type: text/plain\r\n\r\n", false});
+}
+
+// Handler failures become a 500, the connection stays usable
+static task<Response> guarded(task<Response> work)
+{
+    try
+    {
+        co_return co_await std::move(work);
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << time_stamp() << " Handler failed: " << e.what() << std::endl;
+        co_return Response{500, "HTTP/1.1 500 Internal Server Error\r\nContent-Type: text/plain\r\n\r\n", false};
     }
+}
+
+// Parse the head and start the handler coroutine. It runs on this I/O thread
+// until it suspends; inline handlers never do, heavy ones offload to the compute pool.
+void HTTPS_SERVER::dispatch(Connection *conn, size_t length)
+{
+    conn->loop->cancel_timer(conn->timer);
+    conn->timer = 0;
+    std::string_view head = conn->in.view().substr(0, length);
+    conn->request.assign(head.data(), head.size());
+    conn->in.consume(length);
+    conn->pool->release_buffer(conn->in);
+    conn->trace.mark(PHASE_READ);
+
+    std::vector<std::string> tokens = split(conn->request);
+    conn->keep_alive = keep_alive_requested(conn->request);
+    conn->trace.mark(PHASE_PARSE);
+
+    conn->req = Request();
+    conn->req.tokens = std::move(tokens);
+    conn->req.head = conn->request;
+    conn->req.content_length = content_length(conn->request);
+    conn->req.io = conn;
+    conn->body_remaining = conn->req.content_length;
+    conn->state = Connection::HANDLING;
+    watch(conn, 0);
+    account(conn);
+
+    requests_total++;
+    const Route &route = find_route(conn->req.tokens);
+    task<Response> work = route.handler ? route.handler(conn->req) : run_sync(conn->req, route);
+    if (route.handler)
+        requests_async++;
+    else if (route.cost == COST_INLINE)
+        requests_inline++;
     else
+        requests_heavy++;
+
+    spawn(guarded(std::move(work)), [this, conn](Response response)
+          {
+        if (conn->loop->in_loop_thread())
+            finish_request(conn, response);
+        else
+            conn->loop->post([this, conn, response]()
+                             { finish_request(conn, response); }); });
+}
+
+// The synchronous handlers see the whole request, like before
+task<Response> HTTPS_SERVER::run_sync(Request &request, const Route &route)
+{
+    if (request.content_length > MAX_REQUEST_SIZE)
+        co_return Response{413, "HTTP/1.1 413 Payload Too Large\r\nContent-Type: text/plain\r\n\r\n", false};
+    if (request.content_length > 0)
     {
-        response = NOT_IMPLEMENTED;
-        response_status = 400; // Bad Request
+        if (!co_await request.read_body())
+            co_return Response{400, NOT_IMPLEMENTED, false};
+        request.tokens = split(request.head + request.body);
     }
 
-    SSL_write(ssl, response.c_str(), response.length());
+    if (route.cost == COST_HEAVY)
+        co_await request.offload(route.priority);
+
+    Response response;
+    response.text = handle_route(request.tokens, response.status);
+    // GET_handler answers /stop with an empty response, the HTTP server's convention
+    response.stop = response.text.empty() && request.tokens.size() > 2 && request.tokens[0] == "get" && request.tokens[1] == "stop";
+    co_return response;
+}
+
+void HTTPS_SERVER::finish_request(Connection *conn, const Response &response)
+{
+    conn->trace.mark(PHASE_HANDLER);
+    conn->status = response.status;
+
+    if (conn->broken)
+    {
+        close_connection(conn);
+        return;
+    }
+    if (response.written)
+    {
+        // Streamed by the handler, no framing, the connection is not reused
+        conn->keep_alive = false;
+        request_done(conn);
+        return;
+    }
+    // An unread body would be taken for the next request
+    if (conn->body_remaining > 0 || draining)
+        conn->keep_alive = false;
+
+    if (response.stop)
+    {
+        // GET /stop: answer, then drain like on SIGINT
+        std::cerr << time_stamp() << " Remote command: stop. Draining." << std::endl;
+        command(COMMAND_DRAIN);
+        conn->keep_alive = false;
+        conn->out = frame_response(RESPONSE_STUB + "Stopping", false);
+    }
+    else if (response.text.empty())
+    {
+        // A handler that neither answered nor wrote the response itself
+        std::cerr << time_stamp() << " Handler returned no response" << std::endl;
+        conn->status = 500;
+        conn->out = frame_response("HTTP/1.1 500 Internal Server Error\r\nContent-Type: text/plain\r\n\r\n", conn->keep_alive);
+    }
+    else
+        conn->out = frame_response(response.text, conn->keep_alive);
+    account(conn);
+    conn->state = Connection::WRITING;
+    do_write(conn);
+}
+
+void HTTPS_SERVER::do_write(Connection *conn)
+{
+    // Without partial write mode SSL_write sends all or asks to be retried with the same buffer
+    ERR_clear_error();
+    int ret = SSL_write(conn->ssl, conn->out.data(), conn->out.size());
+    if (ret <= 0)
+    {
+        uint32_t events;
+        if (want_io(conn->ssl, ret, events))
+            watch(conn, events);
+        else
+            close_connection(conn);
+        return;
+    }
+    request_done(conn);
+}
+
+// Response is out: log, then close or wait for the next request
+void HTTPS_SERVER::request_done(Connection *conn)
+{
+    conn->trace.mark(PHASE_WRITE);
 
     // Log the request and response along with client details
-    log_request_response(ssl, request, response_status, start_time);
+    log_request_response(conn->ssl, conn->request, conn->status, conn->trace);
+    conn->trace.mark(PHASE_LOG);
+    conn->trace.finish();
+
+    if (!conn->keep_alive || draining)
+    {
+        close_connection(conn);
+        return;
+    }
+
+    // Keep-alive: wait for the next request, it may already be buffered.
+    // The request strings are freed, an idle connection keeps no heap.
+    conn->trace = RequestTrace();
+    release_string(conn->req.head);
+    release_string(conn->req.body);
+    conn->req = Request();
+    release_string(conn->request);
+    release_string(conn->out);
+    account(conn);
+    conn->status = 200;
+    conn->state = Connection::READING;
+    watch(conn, EPOLLIN);
+    arm_idle_timer(conn);
+
+    // A pipelined request may be buffered already, epoll does not report it.
+    // Read it from the loop: here we are still on the stack of the previous
+    // request, and a client pipelining without end would recurse and starve
+    // the other connections of the loop.
+    if (!conn->in.empty() || SSL_has_pending(conn->ssl))
+        conn->loop->post([this, conn, group = conn->group, loop_index = conn->loop_index]()
+                         {
+            // Closed meanwhile (drain cut), or epoll already started the request
+            if (group->open[loop_index].count(conn) && conn->state == Connection::READING)
+                do_read(conn); });
+}
+
+// Body bytes for a suspended or starting handler read: buffered ones first,
+// then the socket. False while the socket has nothing.
+bool HTTPS_SERVER::handler_read(Connection *conn)
+{
+    std::string &chunk = *conn->read_chunk;
+    chunk.clear();
+    if (conn->body_remaining == 0)
+        return true;
+
+    if (conn->in.empty())
+    {
+        int bytes_received = 0;
+        if (!read_some(conn, bytes_received))
+        {
+            conn->broken = true;
+            return true;
+        }
+        if (bytes_received <= 0)
+        {
+            uint32_t events;
+            if (want_io(conn->ssl, bytes_received, events))
+            {
+                watch(conn, events);
+                arm_handler_timer(conn);
+                return false;
+            }
+            conn->broken = true;
+            return true; // Empty chunk: client gone
+        }
+    }
+
+    // Bytes past the body belong to the next request
+    size_t take = std::min(conn->in.size(), conn->body_remaining);
+    chunk.assign(conn->in.data + conn->in.begin, take);
+    conn->in.consume(take);
+    conn->pool->release_buffer(conn->in);
+    conn->body_remaining -= take;
+    return true;
+}
+
+bool HTTPS_SERVER::handler_write(Connection *conn)
+{
+    if (conn->write_data->empty())
+    {
+        *conn->write_ok = true;
+        return true;
+    }
+
+    ERR_clear_error();
+    int ret = SSL_write(conn->ssl, conn->write_data->data(), conn->write_data->size());
+    if (ret <= 0)
+    {
+        uint32_t events;
+        if (want_io(conn->ssl, ret, events))
+        {
+            watch(conn, events);
+            arm_handler_timer(conn);
+            return false;
+        }
+        conn->broken = true;
+    }
+    *conn->write_ok = ret > 0;
+    return true;
+}
+
+// Socket event while the handler waits in a read or write
+void HTTPS_SERVER::handler_io(Connection *conn)
+{
+    if (!conn->waiter)
+        return;
+    bool done = conn->read_chunk ? handler_read(conn) : handler_write(conn);
+    if (done)
+        resume_handler(conn);
+}
+
+// The handler's read or write is done, or failed: continue it
+void HTTPS_SERVER::resume_handler(Connection *conn)
+{
+    conn->loop->cancel_timer(conn->timer);
+    conn->timer = 0;
+    std::coroutine_handle<> handler = std::exchange(conn->waiter, nullptr);
+    conn->read_chunk = nullptr;
+    conn->write_data = nullptr;
+    conn->write_ok = nullptr;
+    watch(conn, 0);
+    handler.resume();
+}
 
-    // Bi-directional shutdown (more robust)
-    int sd = SSL_get_fd(ssl);
-    if (sd != -1)
-    {                      // Check if the socket is valid
-        SSL_shutdown(ssl); // Send and receive close_notify
-        close(sd);
+// RequestIo of the connection. Handlers may call these from the compute
+// pool, the I/O itself always runs on the connection's event loop.
+bool Connection::read(std::coroutine_handle<> handler, std::string &chunk)
+{
+    if (!loop->in_loop_thread())
+    {
+        loop->post([this, handler, &chunk]()
+                   {
+            waiter = handler;
+            read_chunk = &chunk;
+            server->handler_io(this); });
+        return true;
     }
-    SSL_free(ssl);
+
+    read_chunk = &chunk;
+    if (server->handler_read(this))
+    {
+        read_chunk = nullptr;
+        return false; // Data at hand, no suspension
+    }
+    waiter = handler;
+    return true;
+}
+
+bool Connection::write(std::coroutine_handle<> handler, const std::string &data, bool &ok)
+{
+    if (!loop->in_loop_thread())
+    {
+        loop->post([this, handler, &data, &ok]()
+                   {
+            waiter = handler;
+            write_data = &data;
+            write_ok = &ok;
+            server->handler_io(this); });
+        return true;
+    }
+
+    write_data = &data;
+    write_ok = &ok;
+    if (server->handler_write(this))
+    {
+        write_data = nullptr;
+        write_ok = nullptr;
+        return false;
+    }
+    waiter = handler;
+    return true;
+}
+
+size_t Connection::memory() const
+{
+    size_t bytes = sizeof(Connection) + string_heap(request) + string_heap(out) + string_heap(req.head) +
+                   string_heap(req.body) + req.tokens.capacity() * sizeof(std::string);
+    for (const std::string &token : req.tokens)
+        bytes += string_heap(token);
+    return in.data != nullptr ? bytes + IO_BUFFER_SIZE : bytes;
+}
+
+bool Connection::sleep(std::coroutine_handle<> handler, int delay_ms)
+{
+    auto start_timer = [this, handler, delay_ms]()
+    {
+        loop->add_timer(delay_ms, [handler]()
+                        { handler.resume(); });
+    };
+    if (loop->in_loop_thread())
+        start_timer();
+    else
+        loop->post(start_timer);
+    return true;
+}
+
+bool Connection::offload(std::coroutine_handle<> handler, TaskPriority priority)
+{
+    group->compute->enqueue([handler]()
+                            { handler.resume(); },
+                            priority);
+    return true;
+}
+
+// Socket interest, 0 takes it out of the loop: level triggered epoll would
+// keep reporting a hang up while nothing is waiting for the socket
+void HTTPS_SERVER::watch(Connection *conn, uint32_t events)
+{
+    if (events == 0)
+    {
+        if (conn->registered)
+            conn->loop->remove(conn->fd);
+        conn->registered = false;
+    }
+    else if (conn->registered)
+        conn->loop->modify(conn->fd, events);
+    else
+    {
+        conn->loop->add(conn->fd, events, [this, conn](uint32_t)
+                        { on_event(conn); });
+        conn->registered = true;
+    }
+}
+
+// Closes connections that stall in handshake or read, and idle keep-alive ones
+void HTTPS_SERVER::arm_idle_timer(Connection *conn, int timeout_ms)
+{
+    conn->loop->cancel_timer(conn->timer);
+    conn->timer = conn->loop->add_timer(timeout_ms, [this, conn]()
+                                        {
+        conn->timer = 0;
+        close_connection(conn); });
+}
+
+// A handler waits for the client, like an idle connection it gets
+// IDLE_TIMEOUT_MS. Then its read or write fails and the connection closes.
+void HTTPS_SERVER::arm_handler_timer(Connection *conn)
+{
+    conn->loop->cancel_timer(conn->timer);
+    conn->timer = conn->loop->add_timer(IDLE_TIMEOUT_MS, [this, conn]()
+                                        {
+        conn->timer = 0;
+        conn->broken = true;
+        if (!conn->waiter)
+            return;
+        if (conn->read_chunk)
+            conn->read_chunk->clear(); // Empty chunk: client gone
+        if (conn->write_ok)
+            *conn->write_ok = false;
+        resume_handler(conn); });
+}
+
+void HTTPS_SERVER::close_connection(Connection *conn)
+{
+    conn->loop->cancel_timer(conn->timer);
+    watch(conn, 0);
+
+    // Send close_notify, do not wait for the peer's one on a non-blocking socket
+    ERR_clear_error();
+    if (SSL_is_init_finished(conn->ssl))
+        SSL_shutdown(conn->ssl);
+    ERR_clear_error(); // Errors of a dropped connection must not fail the next one on this thread
+    close(conn->fd);
+    conn->pool->release_ssl(conn->ssl);
+    conn->pool->release_buffer(conn->in, true);
+    conn->group->open[conn->loop_index].erase(conn);
+    connection_bytes -= conn->accounted;
+    delete conn;
+    connections_open--;
+}
+
+// Keep the server total of Connection::memory() current
+void HTTPS_SERVER::account(Connection *conn)
+{
+    size_t bytes = conn->memory();
+    connection_bytes += (long)bytes - (long)conn->accounted;
+    conn->accounted = bytes;
+}
+
+// Handler of a split request, sets the status for the log
+std::string HTTPS_SERVER::handle_route(const std::vector<std::string> &tokens, int &status)
+{
+    status = 200; // Default response status
+    if (tokens.size() <= 2)
+    {
+        status = 400; // Bad Request
+        return NOT_IMPLEMENTED;
+    }
+
+    const std::string &method = tokens[0];
+    if (method == "get" && tokens[1] == "trace")
+        return "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n\r\n" + trace_export_json();
+    if (method == "get" && tokens[1] == "metrics")
+        return metrics();
+    if (method == "get")
+        return GET_handler(tokens); // Assuming GET_handler is defined elsewhere
+    if (method == "post")
+        return POST_handler(tokens); // Assuming POST_handler is defined elsewhere
+
+    status = 501; // Not Implemented
+    return NOT_IMPLEMENTED;
+}
+
+// Plain text counters for /metrics
+std::string HTTPS_SERVER::metrics()
+{
+    size_t compute_queue = 0;
+    size_t ssl_pooled = 0, buffers_in_use = 0, slab_bytes = 0;
+    unsigned long ssl_reused = 0;
+    for (auto &group : groups)
+    {
+        compute_queue += group.compute->pending();
+        for (auto pool : group.pools)
+        {
+            ssl_pooled += pool->ssl_pooled();
+            ssl_reused += pool->ssl_reused();
+            buffers_in_use += pool->buffers_in_use();
+            slab_bytes += pool->slab_bytes();
+        }
+    }
+
+    // Per connection: own state plus the whole OpenSSL heap, which also holds
+    // the context and the pooled SSL objects, so an upper bound
+    long open = std::max(1L, connections_open.load());
+    long tls_heap = tls_heap_bytes();
+    std::ostringstream out;
+    out << "connections_open " << connections_open << "\n"
+        << "connections_rejected " << connections_rejected << "\n"
+        << "connection_bytes " << connection_bytes << "\n"
+        << "io_buffers_in_use " << buffers_in_use << "\n"
+        << "io_buffer_slab_bytes " << slab_bytes << "\n"
+        << "ssl_pooled " << ssl_pooled << "\n"
+        << "ssl_reused " << ssl_reused << "\n"
+        << "tls_heap_bytes " << tls_heap << "\n"
+        << "bytes_per_connection " << (connection_bytes + std::max(0L, tls_heap)) / open << "\n"
+        << "requests_total " << requests_total << "\n"
+        << "requests_inline " << requests_inline << "\n"
+        << "requests_heavy " << requests_heavy << "\n"
+        << "requests_async " << requests_async << "\n"
+        << "compute_queue " << compute_queue << "\n"
+        << "io_threads " << io_threads << "\n"
+        << "compute_threads " << max_threads << "\n";
+    return RESPONSE_STUB + out.str();
 }
 
 // Function to log requests and responses with file size limit
 void HTTPS_SERVER::log_request_response(const SSL *ssl, const std::string &request, int response_status,
-                                        std::chrono::time_point<std::chrono::high_resolution_clock> &start_time)
+                                        const RequestTrace &trace)
 {
     if (log_file == nullptr)
         return;
 
-    auto end_time = std::chrono::high_resolution_clock::now(); // End time for response time calculation
-    double response_time = std::chrono::duration<double, std::milli>(end_time - start_time).count();
-    auto t_stamp = time_stamp(); // get once for speed
+    double response_time = trace.elapsed_ms(); // From accept to the response written
 
     // Lock the mutex before writing to the log file
     std::lock_guard<std::mutex> guard(log_mutex);
+    auto t_stamp = time_stamp(); // get once for speed, under the lock so the records are in time order
 
     // Check if the current log file exceeds the maximum size
-    if (log_file->tellp() > LOG_MAX_SIZE)
+    if (log_file->tellp() > LOG_MAX_SIZE && log_rotation)
     {
         log_file->close();
         delete log_file;
@@ -4,7 +4,13 @@
 #include <string>
 #include <vector>
 #include <fstream> // For logging to a file
+#include <sstream>
+#include <iomanip>
+#include <chrono>
+#include <csignal>
 #include <mutex>   // For std::mutex
+#include <atomic>
+#include <unordered_set>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <unistd.h>
@@ -13,21 +19,130 @@
 #include <openssl/err.h>
 
 #include "../common/thread_pools.hpp"
+#include "../common/event_loop.hpp"
 #include "../common/handlers.hpp"
+#include "../common/routes.hpp"
 #include "../common/parsing.hpp"
+#include "../common/socket_options.hpp"
+#include "../common/cpu_topology.hpp"
+#include "../common/trace.hpp"
+#include "connection_pool.hpp"
+#include "tls_config.hpp"
+#include "handoff.hpp"
 
 #define LOG_MAX_SIZE 1024 * 1024
-// Global variable to control server loop
-extern volatile sig_atomic_t running;
+#define IDLE_TIMEOUT_MS 5000       // Handshake, read and keep-alive idle limit
+#define MAX_REQUEST_SIZE 64 * 1024 // Larger bodies get a 413 from the synchronous handlers
+#define UPGRADE_POLL_MS 100        // Upgrade running: how often the accepting thread checks that the new process lives
+#define DRAIN_IDLE_MS 1000         // Idle keep-alive connections get this long for one more request when draining
+
+// Commands for the accepting thread, sent with HTTPS_SERVER::command()
+enum ServerCommand : char
+{
+    COMMAND_DRAIN = 'D',  // Stop accepting, finish the requests, return from run()
+    COMMAND_UPGRADE = 'U' // Start the new binary, drain once it accepts
+};
+
+struct Connection;
+
+// Event loops doing the socket and TLS work, and the compute pool for
+// heavy handlers. One group per NUMA node with --numa.
+struct WorkerGroup
+{
+    std::vector<EventLoop *> loops;
+    std::vector<ConnectionPool *> pools; // SSL objects and buffers of each loop
+    std::vector<std::unordered_set<Connection *>> open; // Connections of each loop, for draining
+    ThreadPool *compute = nullptr;
+    size_t next_loop = 0;
+};
+
+class HTTPS_SERVER;
+
+// Client connection, owned by its event loop thread. It is also the
+// RequestIo of the handler serving its current request.
+struct Connection : RequestIo
+{
+    enum State
+    {
+        HANDSHAKE,
+        READING,
+        HANDLING, // Handler runs, the socket is watched only while it waits for I/O
+        WRITING
+    };
+
+    HTTPS_SERVER *server = nullptr;
+    int fd = -1;
+    SSL *ssl = nullptr;
+    WorkerGroup *group = nullptr;
+    EventLoop *loop = nullptr;
+    size_t loop_index = 0;
+    ConnectionPool *pool = nullptr;
+    State state = HANDSHAKE;
+    IoBuffer in;         // Received bytes not handled yet
+    std::string request; // Request being handled
+    std::string out;     // Response being written
+    int status = 200;
+    bool keep_alive = false;
+    bool registered = false; // Socket is in the event loop
+    bool broken = false;     // Read or write failed while the handler ran
+    uint64_t timer = 0;
+    size_t accounted = 0; // memory() as last added to the server total
+    RequestTrace trace;
+
+    // Handler of the current request
+    Request req;
+    size_t body_remaining = 0;
+    std::coroutine_handle<> waiter; // Suspended in a read or write
+    std::string *read_chunk = nullptr;
+    const std::string *write_data = nullptr;
+    bool *write_ok = nullptr;
+
+    bool read(std::coroutine_handle<> handler, std::string &chunk) override;
+    bool write(std::coroutine_handle<> handler, const std::string &data, bool &ok) override;
+    bool sleep(std::coroutine_handle<> handler, int delay_ms) override;
+    bool offload(std::coroutine_handle<> handler, TaskPriority priority) override;
+
+    // Bytes held by the connection outside OpenSSL
+    size_t memory() const;
+};
 
 class HTTPS_SERVER
 {
+    friend struct Connection;
+
 private:
     int server_socket;
     struct sockaddr_in server_address;
     int port = 0;
     int max_threads = 0;
-    ThreadPool *pool = nullptr;
+    int io_threads = 0;
+    WorkerOptions worker_options;
+    SocketOptions socket_options;
+    ConnectionOptions connection_options;
+    TlsOptions tls_options;
+    ShutdownOptions shutdown_options;
+    std::vector<WorkerGroup> groups;
+    std::vector<int> cpu_group; // CPU -> worker group, -1 if not served
+    std::vector<int> process_cpus;
+    size_t next_group = 0;
+
+    // Shutdown and hot upgrade, on the accepting thread
+    int command_pipe[2] = {-1, -1};
+    int handoff_socket = -1; // Upgrade requests from a new process
+    int handoff_conn = -1;   // New process that got the listening socket, not ready yet
+    int takeover_conn = -1;  // Old process to tell we are ready
+    pid_t upgrade_pid = -1;  // New process started here, until it accepts or exits
+    std::atomic<bool> draining{false};
+
+    // Counters for /metrics
+    std::atomic<long> connections_open{0};
+    std::atomic<unsigned long> connections_rejected{0};
+    std::atomic<long> connection_bytes{0}; // Sum of Connection::memory()
+    std::atomic<unsigned long> requests_total{0};
+    std::atomic<unsigned long> requests_inline{0};
+    std::atomic<unsigned long> requests_heavy{0};
+    std::atomic<unsigned long> requests_async{0};
+
     // OpenSSL
     SSL_CTX *ctx = nullptr;
 
@@ -36,18 +151,61 @@ private:
     int log_file_index = 0;
     std::string log_file_base = "";
     std::ofstream *log_file = nullptr;
+    std::atomic<bool> log_rotation{true}; // Off once a new process took over, it writes the next segments
 
     // Create SSL context
     SSL_CTX *create_context();
     void configure_context(SSL_CTX *ctx);
+    int create_listener();
+
+    size_t pick_group(int client_socket);
+    void accept_connections();
+    void start_upgrade();
+    void handoff_request();
+    bool handoff_answer();
+    void reap_upgrade();
+    void drain(bool upgraded);
+    void drain_loop(WorkerGroup *group, size_t loop_index, bool cut);
+
+    // Connection state machine, runs on the connection's event loop
+    void start_connection(WorkerGroup *group, size_t loop_index, int client_socket, const RequestTrace &trace);
+    void on_event(Connection *conn);
+    void do_handshake(Connection *conn);
+    void do_read(Connection *conn);
+    void dispatch(Connection *conn, size_t length);
+    void head_too_large(Connection *conn);
+    void finish_request(Connection *conn, const Response &response);
+    void do_write(Connection *conn);
+    void request_done(Connection *conn);
+    void watch(Connection *conn, uint32_t events);
+    void arm_idle_timer(Connection *conn, int timeout_ms = IDLE_TIMEOUT_MS);
+    void close_connection(Connection *conn);
+    void account(Connection *conn);
+    bool read_some(Connection *conn, int &ret);
+
+    // Handler I/O, runs on the event loop, true when the handler can go on
+    bool handler_read(Connection *conn);
+    bool handler_write(Connection *conn);
+    void handler_io(Connection *conn);
+    void resume_handler(Connection *conn);
+    void arm_handler_timer(Connection *conn);
 
-    void handle_client(SSL *ssl);
+    // Adapter for the synchronous handlers
+    task<Response> run_sync(Request &request, const Route &route);
+    // Handler of a split request, runs on the I/O thread or the compute pool
+    std::string handle_route(const std::vector<std::string> &tokens, int &status);
+    std::string metrics();
     void log_request_response(const SSL *ssl, const std::string &request, int response_status,
-                              std::chrono::time_point<std::chrono::high_resolution_clock> &start_time);
+                              const RequestTrace &trace);
 
 public:
-    HTTPS_SERVER(int port, int max_threads, std::string log_file_base);
+    HTTPS_SERVER(int port, const WorkerOptions &worker_options, std::string log_file_base, const SocketOptions &socket_options = SocketOptions(),
+                 const ConnectionOptions &connection_options = ConnectionOptions(), const TlsOptions &tls_options = TlsOptions(),
+                 const ShutdownOptions &shutdown_options = ShutdownOptions());
     ~HTTPS_SERVER();
     int open();
+    // Accept until drained, the log is flushed on return
     void run();
+    // Thread and async signal safe
+    void command(ServerCommand command);
 };
@@ -1,5 +1,4 @@
 #define PORT 8443
-#define MAX_THREADS 5 // Maximum number of worker threads
 
 #include <iostream>
 #include <csignal> // For signal handling
@@ -7,14 +6,17 @@
 
 #include "https_server.hpp"
 
-// Signal handler for graceful shutdown (Ctrl+C)
+static HTTPS_SERVER *server = nullptr;
+
+// Signal handler for graceful shutdown (Ctrl+C, SIGTERM) and hot upgrade (SIGUSR2)
 void signal_handler(int signum)
 {
-    if (signum == SIGINT)
-    {
-        std::cout << time_stamp() << " Shutting down server..." << std::endl;
-        running = false; // Set the flag to stop the server loop
-    }
+    if (server == nullptr)
+        return;
+    if (signum == SIGUSR2)
+        server->command(COMMAND_UPGRADE);
+    else
+        server->command(COMMAND_DRAIN); // The accepting thread stops and drains
 }
 
 int signal_handler_setup()
@@ -24,25 +26,58 @@ int signal_handler_setup()
     sa.sa_handler = signal_handler;
     sigemptyset(&sa.sa_mask);
     sa.sa_flags = 0;
-    if (sigaction(SIGINT, &sa, NULL) == -1)
+    for (int signum : {SIGINT, SIGTERM, SIGUSR2})
     {
-        perror((time_stamp() + " Set signal action failed.").c_str()); // Print error if setting up signal handler fails
-        return 1;                                                      // Exit with error code
+        if (sigaction(signum, &sa, NULL) == -1)
+        {
+            perror((time_stamp() + " Set signal action failed.").c_str()); // Print error if setting up signal handler fails
+            return 1;                                                      // Exit with error code
+        }
     }
+    signal(SIGPIPE, SIG_IGN); // Writes to a closed connection fail instead
     return 0;
 }
 
 int main(int argc, char *argv[])
 {
     int state = 0;
+    SocketOptions socket_options;
+    WorkerOptions worker_options;
+    TraceOptions trace_options;
+    ConnectionOptions connection_options;
+    TlsOptions tls_options;
+    ShutdownOptions shutdown_options;
+    shutdown_options.command.assign(argv, argv + argc);
+    for (int i = 1; i < argc; i++)
+    {
+        if (!parse_socket_option(argv[i], socket_options) && !parse_worker_option(argv[i], worker_options) &&
+            !parse_trace_option(argv[i], trace_options) && !parse_connection_option(argv[i], connection_options) &&
+            !parse_tls_option(argv[i], tls_options) && !parse_shutdown_option(argv[i], shutdown_options))
+        {
+            std::cerr << "Usage: " << argv[0] << " [options]\n"
+                      << socket_options_usage() << worker_options_usage() << trace_options_usage()
+                      << connection_options_usage() << tls_options_usage()
+                      << shutdown_options_usage();
+            return 1;
+        }
+    }
+    // Before OpenSSL allocates anything, for tls_heap_bytes in /metrics
+    if (!tls_memory_tracking())
+        std::cerr << time_stamp() << " OpenSSL memory tracking not available." << std::endl;
+    trace_configure(trace_options);
+
     std::cout << time_stamp() << " UTC time mentioned further. Server initializing." << std::endl; // Server initialization message
     if ((state = signal_handler_setup()) != 0)
         return state;
 
-    auto server = new HTTPS_SERVER(PORT, MAX_THREADS, std::filesystem::current_path()); // Create a new HTTPS server instance
+    server = new HTTPS_SERVER(PORT, worker_options, std::filesystem::current_path(), socket_options,
+                              connection_options, tls_options, shutdown_options); // Create a new HTTPS server instance
 
     if ((state = server->open()) == 0)
-        server->run(); // Start the server if it opens successfully
+        server->run(); // Start the server if it opens successfully, returns drained
 
+    HTTPS_SERVER *stopped = server;
+    server = nullptr;
+    delete stopped;
     return state; // Return the final state (0 if success, other if failure)
 }
@@ -0,0 +1,251 @@
+// Connection handling tests of the HTTPS server (loopback)
+// (C) Anatoly Mazkun, buy me a beer, 2025
+//
+// Starts the server in process with a generated certificate on TEST_PORT,
+// one I/O thread, and talks to it like a client. Exit code: failed tests.
+//
+//   ctest --output-on-failure
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <functional>
+#include <csignal>
+#include <cstring>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/x509.h>
+#include <openssl/pem.h>
+
+#include "https_server.hpp"
+
+#define TEST_PORT 18443
+
+// Self-signed P-256 certificate for localhost in dir
+static std::pair<std::string, std::string> make_certificate(const std::string &dir)
+{
+    EVP_PKEY *key = EVP_EC_gen("P-256");
+    X509 *cert = X509_new();
+    X509_set_version(cert, 2);
+    ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+    X509_gmtime_adj(X509_getm_notBefore(cert), 0);
+    X509_gmtime_adj(X509_getm_notAfter(cert), 24 * 3600);
+    X509_set_pubkey(cert, key);
+    X509_NAME *subject = X509_get_subject_name(cert);
+    X509_NAME_add_entry_by_txt(subject, "CN", MBSTRING_ASC, (const unsigned char *)"localhost", -1, -1, 0);
+    X509_set_issuer_name(cert, subject);
+    X509_sign(cert, key, EVP_sha256());
+
+    std::pair<std::string, std::string> files(dir + "/server.crt", dir + "/server.key");
+    FILE *f = fopen(files.first.c_str(), "w");
+    PEM_write_X509(f, cert);
+    fclose(f);
+    f = fopen(files.second.c_str(), "w");
+    PEM_write_PrivateKey(f, key, nullptr, nullptr, 0, nullptr, nullptr);
+    fclose(f);
+
+    X509_free(cert);
+    EVP_PKEY_free(key);
+    return files;
+}
+
+// Connected TLS client, nullptr on failure. Reads time out after timeout_ms.
+static SSL *connect_tls(SSL_CTX *ctx, int timeout_ms = 10000)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(TEST_PORT);
+    struct timeval timeout = {timeout_ms / 1000, (timeout_ms % 1000) * 1000};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    if (connect(fd, (struct sockaddr *)&address, sizeof(address)) < 0)
+    {
+        close(fd);
+        return nullptr;
+    }
+
+    SSL *ssl = SSL_new(ctx);
+    SSL_set_fd(ssl, fd);
+    if (SSL_connect(ssl) != 1)
+    {
+        ERR_clear_error();
+        SSL_free(ssl);
+        close(fd);
+        return nullptr;
+    }
+    return ssl;
+}
+
+static void close_tls(SSL *ssl)
+{
+    int fd = SSL_get_fd(ssl);
+    SSL_free(ssl);
+    close(fd);
+}
+
+// Everything until the server closes or the read times out
+static std::string read_all(SSL *ssl, bool &closed)
+{
+    std::string data;
+    char buffer[16 * 1024];
+    int n;
+    while ((n = SSL_read(ssl, buffer, sizeof(buffer))) > 0)
+        data.append(buffer, n);
+    int error = SSL_get_error(ssl, n);
+    closed = error == SSL_ERROR_ZERO_RETURN || (error == SSL_ERROR_SYSCALL && errno != EAGAIN);
+    ERR_clear_error();
+    return data;
+}
+
+static size_t count(const std::string &text, const std::string &what)
+{
+    size_t n = 0;
+    for (size_t at = text.find(what); at != std::string::npos; at = text.find(what, at + what.size()))
+        n++;
+    return n;
+}
+
+// Many requests in one stream: the server answers them all, in order, without
+// recursing per request on its loop thread
+static bool test_pipelined(SSL_CTX *ctx)
+{
+    const size_t requests = 5000;
+    SSL *ssl = connect_tls(ctx);
+    if (ssl == nullptr)
+        return false;
+
+    std::string out;
+    for (size_t i = 0; i < requests; i++)
+        out += "GET /hello HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    out += "GET /hello HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n";
+
+    // One thread writes and reads: both sides fill their buffers otherwise
+    int fd = SSL_get_fd(ssl);
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    SSL_set_mode(ssl, SSL_MODE_ENABLE_PARTIAL_WRITE);
+    size_t written = 0;
+    std::string in;
+    char buffer[16 * 1024];
+    bool closed = false;
+    while (!closed)
+    {
+        struct pollfd p = {fd, (short)(POLLIN | (written < out.size() ? POLLOUT : 0)), 0};
+        if (poll(&p, 1, 10000) <= 0)
+            break; // Stalled
+        if (written < out.size())
+        {
+            int n = SSL_write(ssl, out.data() + written, out.size() - written);
+            if (n > 0)
+                written += n;
+        }
+        int n;
+        while ((n = SSL_read(ssl, buffer, sizeof(buffer))) > 0)
+            in.append(buffer, n);
+        int error = SSL_get_error(ssl, n);
+        closed = error != SSL_ERROR_WANT_READ && error != SSL_ERROR_WANT_WRITE;
+        ERR_clear_error();
+    }
+    close_tls(ssl);
+
+    size_t answered = count(in, "HTTP/1.1 200 OK");
+    if (answered != requests + 1)
+        std::cerr << "  " << answered << " of " << requests + 1 << " pipelined requests answered" << std::endl;
+    return answered == requests + 1;
+}
+
+// A body shorter than its Content-Length: the handler reading it times out
+// like an idle connection, the server closes instead of waiting forever
+static bool test_truncated_body(SSL_CTX *ctx)
+{
+    SSL *ssl = connect_tls(ctx, IDLE_TIMEOUT_MS + 3000);
+    if (ssl == nullptr)
+        return false;
+
+    std::string out = "POST /data HTTP/1.1\r\nHost: localhost\r\nContent-Length: 100\r\n\r\n";
+    SSL_write(ssl, out.data(), out.size());
+    bool closed = false;
+    read_all(ssl, closed);
+    close_tls(ssl);
+
+    if (!closed)
+        std::cerr << "  connection still open after " << IDLE_TIMEOUT_MS + 3000 << " ms" << std::endl;
+    return closed;
+}
+
+// A head larger than the read buffer gets a 431 before the server closes
+static bool test_head_too_large(SSL_CTX *ctx)
+{
+    SSL *ssl = connect_tls(ctx);
+    if (ssl == nullptr)
+        return false;
+
+    // Exactly the buffer: the server reads it all and closes cleanly
+    std::string out = "GET /hello HTTP/1.1\r\nHost: localhost\r\nX-Padding: ";
+    out.resize(IO_BUFFER_SIZE, 'x');
+    SSL_write(ssl, out.data(), out.size());
+    bool closed = false;
+    std::string in = read_all(ssl, closed);
+    close_tls(ssl);
+
+    bool ok = closed && in.compare(0, 13, "HTTP/1.1 431 ") == 0;
+    if (!ok)
+        std::cerr << "  got \"" << in.substr(0, in.find('\r')) << "\"" << (closed ? "" : ", still open") << std::endl;
+    return ok;
+}
+
+static bool run_test(const std::string &name, const std::function<bool()> &test)
+{
+    std::cout << name << " ... " << std::flush;
+    bool ok = test();
+    std::cout << (ok ? "ok" : "FAILED") << std::endl;
+    return ok;
+}
+
+int main()
+{
+    signal(SIGPIPE, SIG_IGN);
+    char dir_template[] = "/tmp/https_server_test_XXXXXX";
+    std::string dir = mkdtemp(dir_template);
+
+    WorkerOptions worker_options;
+    worker_options.workers = 2;
+    worker_options.io_threads = 1; // All connections share one loop
+    TlsOptions tls_options;
+    tls_options.certificates = {make_certificate(dir)};
+    HTTPS_SERVER server(TEST_PORT, worker_options, dir, SocketOptions(), ConnectionOptions(), tls_options);
+    if (server.open() != 0)
+    {
+        std::cerr << "Server did not open on port " << TEST_PORT << std::endl;
+        return 1;
+    }
+    std::thread serving([&server]()
+                        { server.run(); });
+
+    SSL_CTX *ctx = SSL_CTX_new(TLS_client_method());
+    SSL_CTX_set_verify(ctx, SSL_VERIFY_NONE, nullptr);
+
+    int failed = 0;
+    failed += !run_test("pipelined requests on one connection", [ctx]()
+                        { return test_pipelined(ctx); });
+    failed += !run_test("truncated request body", [ctx]()
+                        { return test_truncated_body(ctx); });
+    failed += !run_test("request head too large", [ctx]()
+                        { return test_head_too_large(ctx); });
+
+    server.command(COMMAND_DRAIN);
+    serving.join();
+    SSL_CTX_free(ctx);
+    std::cout << failed << " failed" << std::endl;
+    return failed;
+}
@@ -0,0 +1,131 @@
+#include "tls_config.hpp"
+#include "../common/parsing.hpp"
+
+#include <iostream>
+#include <algorithm>
+#include <openssl/err.h>
+#if defined(__aarch64__) && defined(__linux__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+bool cpu_has_aes()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_cpu_supports("aes");
+#elif defined(__aarch64__) && defined(__linux__)
+    return (getauxval(AT_HWCAP) & HWCAP_AES) != 0;
+#elif defined(__aarch64__) && defined(__APPLE__)
+    return true; // Every Apple silicon core has the ARMv8 crypto extension
+#else
+    return false;
+#endif
+}
+
+// AES-GCM is several times faster than ChaCha20 with AES instructions and
+// several times slower without them
+std::string default_ciphersuites()
+{
+    if (cpu_has_aes())
+        return "TLS_AES_128_GCM_SHA256:TLS_AES_256_GCM_SHA384:TLS_CHACHA20_POLY1305_SHA256";
+    return "TLS_CHACHA20_POLY1305_SHA256:TLS_AES_128_GCM_SHA256:TLS_AES_256_GCM_SHA384";
+}
+
+std::string default_cipher_list()
+{
+    const std::string aes = "ECDHE-ECDSA-AES128-GCM-SHA256:ECDHE-RSA-AES128-GCM-SHA256:"
+                            "ECDHE-ECDSA-AES256-GCM-SHA384:ECDHE-RSA-AES256-GCM-SHA384";
+    const std::string chacha = "ECDHE-ECDSA-CHACHA20-POLY1305:ECDHE-RSA-CHACHA20-POLY1305";
+    return cpu_has_aes() ? aes + ":" + chacha : chacha + ":" + aes;
+}
+
+int configure_tls(SSL_CTX *ctx, const TlsOptions &options)
+{
+    int version = 0;
+    if (options.min_version == "1.2")
+        version = TLS1_2_VERSION;
+    else if (options.min_version == "1.3")
+        version = TLS1_3_VERSION;
+    if (version == 0 || SSL_CTX_set_min_proto_version(ctx, version) != 1)
+    {
+        std::cerr << time_stamp() << " Bad minimum TLS version " << options.min_version << std::endl;
+        return 1;
+    }
+
+    std::string suites = options.ciphersuites.empty() ? default_ciphersuites() : options.ciphersuites;
+    std::string ciphers = options.cipher_list.empty() ? default_cipher_list() : options.cipher_list;
+    if (SSL_CTX_set_ciphersuites(ctx, suites.c_str()) != 1 ||
+        (version < TLS1_3_VERSION && SSL_CTX_set_cipher_list(ctx, ciphers.c_str()) != 1))
+    {
+        std::cerr << time_stamp() << " Bad cipher list" << std::endl;
+        ERR_print_errors_fp(stderr);
+        return 1;
+    }
+    if (SSL_CTX_set1_groups_list(ctx, options.groups.c_str()) != 1)
+    {
+        std::cerr << time_stamp() << " Bad groups " << options.groups << std::endl;
+        ERR_print_errors_fp(stderr);
+        return 1;
+    }
+
+    // Our order picks the cipher, but a client that puts ChaCha20 first
+    // (no AES instructions of its own) gets ChaCha20
+    SSL_CTX_set_options(ctx, SSL_OP_CIPHER_SERVER_PREFERENCE | SSL_OP_PRIORITIZE_CHACHA);
+
+    // Each key type fills its own slot of the context, OpenSSL picks the
+    // certificate the client's signature algorithms allow
+    auto certificates = options.certificates;
+    if (certificates.empty())
+        certificates.emplace_back("server.crt", "server.key");
+    for (const auto &[cert, key] : certificates)
+    {
+        if (SSL_CTX_use_certificate_chain_file(ctx, cert.c_str()) != 1)
+        {
+            std::cerr << time_stamp() << " Error loading certificate " << cert << std::endl;
+            ERR_print_errors_fp(stderr);
+            return 1;
+        }
+        if (SSL_CTX_use_PrivateKey_file(ctx, key.c_str(), SSL_FILETYPE_PEM) != 1 || SSL_CTX_check_private_key(ctx) != 1)
+        {
+            std::cerr << time_stamp() << " Error loading private key " << key << std::endl;
+            ERR_print_errors_fp(stderr);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+std::string tls_summary(const TlsOptions &options)
+{
+    return "TLS " + options.min_version + "+, AES instructions: " + (cpu_has_aes() ? "yes" : "no") +
+           ", suites " + (options.ciphersuites.empty() ? default_ciphersuites() : options.ciphersuites) +
+           ", groups " + options.groups + ", " + std::to_string(std::max<size_t>(1, options.certificates.size())) + " certificate(s)";
+}
+
+bool parse_tls_option(const std::string &arg, TlsOptions &options)
+{
+    std::string cert;
+    if (parse_string_arg(arg, "--cert", cert))
+    {
+        size_t comma = cert.find(',');
+        if (comma == std::string::npos)
+            options.certificates.emplace_back(cert, cert); // Key in the same PEM file
+        else
+            options.certificates.emplace_back(cert.substr(0, comma), cert.substr(comma + 1));
+        return true;
+    }
+    return parse_string_arg(arg, "--tls-min", options.min_version) ||
+           parse_string_arg(arg, "--tls13-ciphers", options.ciphersuites) ||
+           parse_string_arg(arg, "--tls12-ciphers", options.cipher_list) ||
+           parse_string_arg(arg, "--tls-groups", options.groups);
+}
+
+std::string tls_options_usage()
+{
+    return "TLS options (HTTPS):\n"
+           "\t--cert=<crt>[,<key>]\tcertificate and key, repeat for an ECDSA and an RSA one, default: server.crt,server.key\n"
+           "\t--tls-min=<1.2|1.3>\tminimum protocol version, default: 1.2\n"
+           "\t--tls13-ciphers=<list>\tTLS 1.3 suites, default: AES-GCM first if the CPU has AES instructions, else ChaCha20\n"
+           "\t--tls12-ciphers=<list>\tTLS 1.2 ciphers, same default order\n"
+           "\t--tls-groups=<list>\tkey exchange groups, default: X25519:P-256:P-384\n";
+}
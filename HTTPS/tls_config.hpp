@@ -0,0 +1,34 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <openssl/ssl.h>
+
+// TLS policy of the server context. Empty cipher lists are chosen by CPU:
+// AES-GCM first with AES instructions, ChaCha20-Poly1305 first without.
+struct TlsOptions
+{
+    std::string min_version = "1.2"; // "1.2" or "1.3"
+    std::string ciphersuites;        // TLS 1.3 suites, OpenSSL syntax
+    std::string cipher_list;         // TLS 1.2 ciphers, OpenSSL syntax
+    std::string groups = "X25519:P-256:P-384";
+    // Certificate and key files. One per key type: with an ECDSA and an RSA
+    // certificate OpenSSL serves ECDSA to the clients that accept it.
+    // Empty: server.crt and server.key.
+    std::vector<std::pair<std::string, std::string>> certificates;
+};
+
+// AES instructions (AES-NI, ARMv8 AES) on this CPU
+bool cpu_has_aes();
+// Default suites for this CPU
+std::string default_ciphersuites();
+std::string default_cipher_list();
+
+// Apply the options to a context, 0 on success. Errors are printed.
+int configure_tls(SSL_CTX *ctx, const TlsOptions &options);
+// One line description of the applied policy for the startup log
+std::string tls_summary(const TlsOptions &options);
+
+// Parse one command line argument like "--tls-min=1.3" or "--cert=ec.crt,ec.key"
+bool parse_tls_option(const std::string &arg, TlsOptions &options);
+std::string tls_options_usage();
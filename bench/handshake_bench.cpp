@@ -0,0 +1,317 @@
+// Full TLS handshakes per second for certificate, group and cipher choices (loopback)
+// (C) Anatoly Mazkun, buy me a beer, 2025
+//
+// Keys and self-signed certificates are generated at start. Each case runs an
+// in-process server on one thread with the server's configure_tls() and two
+// client threads doing full handshakes (no resumption) for the given time:
+//  - handshakes/s and server CPU per handshake, the part a server pays
+//  - MB/s of one 64 MB upload, the bulk cipher cost
+// The cert column shows which certificate the client got from a dual-cert server.
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <csignal>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/x509.h>
+#include <openssl/pem.h>
+
+#include "../HTTPS/tls_config.hpp"
+
+static const size_t BULK_BYTES = 64 * 1024 * 1024;
+
+// Self-signed certificate for localhost, written as PEM to dir/name.crt and dir/name.key
+static std::pair<std::string, std::string> make_certificate(const std::string &dir, const std::string &name, EVP_PKEY *key)
+{
+    X509 *cert = X509_new();
+    X509_set_version(cert, 2);
+    ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+    X509_gmtime_adj(X509_getm_notBefore(cert), 0);
+    X509_gmtime_adj(X509_getm_notAfter(cert), 24 * 3600);
+    X509_set_pubkey(cert, key);
+    X509_NAME *subject = X509_get_subject_name(cert);
+    X509_NAME_add_entry_by_txt(subject, "CN", MBSTRING_ASC, (const unsigned char *)"localhost", -1, -1, 0);
+    X509_set_issuer_name(cert, subject);
+    X509_sign(cert, key, EVP_sha256());
+
+    std::pair<std::string, std::string> files(dir + "/" + name + ".crt", dir + "/" + name + ".key");
+    FILE *f = fopen(files.first.c_str(), "w");
+    PEM_write_X509(f, cert);
+    fclose(f);
+    f = fopen(files.second.c_str(), "w");
+    PEM_write_PrivateKey(f, key, nullptr, nullptr, 0, nullptr, nullptr);
+    fclose(f);
+
+    X509_free(cert);
+    EVP_PKEY_free(key);
+    return files;
+}
+
+// Handshake flights are small writes: without it Nagle and delayed ACK add 40 ms
+static void set_nodelay(int fd)
+{
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+}
+
+// One thread server: handshake, one byte of response, then read until the client closes
+class BenchServer
+{
+public:
+    std::atomic<unsigned long> handshakes{0};
+    int port = 0;
+
+    BenchServer(const TlsOptions &options)
+    {
+        ctx = SSL_CTX_new(TLS_server_method());
+        SSL_CTX_set_mode(ctx, SSL_MODE_RELEASE_BUFFERS); // As the server does
+        if (configure_tls(ctx, options) != 0)
+            exit(EXIT_FAILURE);
+
+        listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+        int reuse = 1;
+        setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        struct sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.sin_port = 0; // Any free port
+        if (bind(listen_fd, (struct sockaddr *)&address, sizeof(address)) < 0 || listen(listen_fd, 128) < 0)
+        {
+            perror("Bench server bind/listen failed");
+            exit(EXIT_FAILURE);
+        }
+        socklen_t len = sizeof(address);
+        getsockname(listen_fd, (struct sockaddr *)&address, &len);
+        port = ntohs(address.sin_port);
+
+        worker = std::thread([this]
+                             { serve(); });
+    }
+
+    ~BenchServer()
+    {
+        stop = true;
+        shutdown(listen_fd, SHUT_RDWR);
+        worker.join();
+        close(listen_fd);
+        SSL_CTX_free(ctx);
+    }
+
+    // CPU time of the server thread so far
+    double cpu_seconds() const { return cpu_ns / 1e9; }
+
+private:
+    SSL_CTX *ctx = nullptr;
+    int listen_fd = -1;
+    std::atomic<bool> stop{false};
+    std::atomic<long> cpu_ns{0};
+    std::thread worker;
+
+    void serve()
+    {
+        char buffer[16 * 1024];
+        while (!stop)
+        {
+            int fd = accept(listen_fd, nullptr, nullptr);
+            if (fd < 0)
+                continue;
+            set_nodelay(fd);
+            SSL *ssl = SSL_new(ctx);
+            SSL_set_fd(ssl, fd);
+            if (SSL_accept(ssl) == 1 && SSL_write(ssl, "x", 1) == 1)
+            {
+                handshakes++;
+                while (SSL_read(ssl, buffer, sizeof(buffer)) > 0)
+                    ;
+            }
+            SSL_free(ssl);
+            close(fd);
+
+            struct timespec now;
+            clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+            cpu_ns = now.tv_sec * 1000000000L + now.tv_nsec;
+        }
+    }
+};
+
+struct ClientOptions
+{
+    bool tls12 = false;   // Client caps the version at TLS 1.2
+    std::string sigalgs;  // Signature algorithms the client accepts, empty: OpenSSL default
+};
+
+static SSL_CTX *client_context(const ClientOptions &options)
+{
+    SSL_CTX *ctx = SSL_CTX_new(TLS_client_method());
+    SSL_CTX_set_verify(ctx, SSL_VERIFY_NONE, nullptr);
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF); // Every handshake is a full one
+    if (options.tls12)
+        SSL_CTX_set_max_proto_version(ctx, TLS1_2_VERSION);
+    if (!options.sigalgs.empty())
+        SSL_CTX_set1_sigalgs_list(ctx, options.sigalgs.c_str());
+    return ctx;
+}
+
+// Connect and finish the handshake, nullptr on failure
+static SSL *connect_tls(SSL_CTX *ctx, int port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(port);
+    set_nodelay(fd);
+    if (connect(fd, (struct sockaddr *)&address, sizeof(address)) < 0)
+    {
+        close(fd);
+        return nullptr;
+    }
+
+    SSL *ssl = SSL_new(ctx);
+    SSL_set_fd(ssl, fd);
+    char byte;
+    if (SSL_connect(ssl) != 1 || SSL_read(ssl, &byte, 1) != 1)
+    {
+        ERR_clear_error();
+        SSL_free(ssl);
+        close(fd);
+        return nullptr;
+    }
+    return ssl;
+}
+
+static void close_tls(SSL *ssl)
+{
+    int fd = SSL_get_fd(ssl);
+    SSL_free(ssl);
+    close(fd);
+}
+
+int main(int argc, char *argv[])
+{
+    double seconds = argc > 1 ? std::atof(argv[1]) : 2;
+    signal(SIGPIPE, SIG_IGN);
+
+    char dir_template[] = "/tmp/handshake_bench_XXXXXX";
+    std::string dir = mkdtemp(dir_template);
+    auto rsa4096 = make_certificate(dir, "rsa4096", EVP_RSA_gen(4096));
+    auto rsa2048 = make_certificate(dir, "rsa2048", EVP_RSA_gen(2048));
+    auto p256 = make_certificate(dir, "p256", EVP_EC_gen("P-256"));
+
+    struct Case
+    {
+        std::string name;
+        TlsOptions server;
+        ClientOptions client;
+    };
+    std::vector<Case> cases(10);
+    cases[0].name = "rsa-4096";
+    cases[0].server.certificates = {rsa4096};
+    cases[1].name = "rsa-2048";
+    cases[1].server.certificates = {rsa2048};
+    cases[2].name = "ecdsa-p256";
+    cases[2].server.certificates = {p256};
+    cases[3].name = "ecdsa-p256 group p-256";
+    cases[3].server.certificates = {p256};
+    cases[3].server.groups = "P-256";
+    cases[4].name = "ecdsa-p256 tls1.2";
+    cases[4].server.certificates = {p256};
+    cases[4].client.tls12 = true;
+    cases[5].name = "ecdsa+rsa, any client";
+    cases[5].server.certificates = {p256, rsa2048};
+    cases[6].name = "ecdsa+rsa, rsa-only client";
+    cases[6].server.certificates = {p256, rsa2048};
+    cases[6].client.sigalgs = "rsa_pss_rsae_sha256:rsa_pkcs1_sha256";
+    cases[7].name = "ecdsa-p256 aes-128-gcm";
+    cases[7].server.certificates = {p256};
+    cases[7].server.ciphersuites = "TLS_AES_128_GCM_SHA256";
+    cases[8].name = "ecdsa-p256 aes-256-gcm";
+    cases[8].server.certificates = {p256};
+    cases[8].server.ciphersuites = "TLS_AES_256_GCM_SHA384";
+    cases[9].name = "ecdsa-p256 chacha20";
+    cases[9].server.certificates = {p256};
+    cases[9].server.ciphersuites = "TLS_CHACHA20_POLY1305_SHA256";
+
+    std::cout << "AES instructions: " << (cpu_has_aes() ? "yes" : "no") << ", default suites "
+              << default_ciphersuites() << "\n"
+              << seconds << " s per case, 2 client threads, default group X25519" << std::endl;
+    std::cout << std::left << std::setw(28) << "case" << std::setw(6) << "cert" << std::setw(30) << "cipher"
+              << std::right << std::setw(12) << "hs/s" << std::setw(14) << "server us/hs" << std::setw(10) << "MB/s"
+              << std::endl;
+
+    for (const auto &c : cases)
+    {
+        BenchServer server(c.server);
+        SSL_CTX *client_ctx = client_context(c.client);
+
+        // Handshakes for the given time
+        std::atomic<bool> done{false};
+        std::vector<std::thread> clients;
+        for (int i = 0; i < 2; i++)
+            clients.emplace_back([&]
+                                 {
+                while (!done)
+                    if (SSL *ssl = connect_tls(client_ctx, server.port))
+                        close_tls(ssl); });
+        double cpu_start = server.cpu_seconds();
+        unsigned long start_count = server.handshakes;
+        auto start = std::chrono::steady_clock::now();
+        std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+        unsigned long count = server.handshakes - start_count;
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        double cpu = server.cpu_seconds() - cpu_start;
+        done = true;
+        for (auto &client : clients)
+            client.join();
+
+        // Bulk upload on one connection, also shows what was negotiated
+        std::string cert = "-", cipher = "-";
+        double mb_per_s = 0;
+        if (SSL *ssl = connect_tls(client_ctx, server.port))
+        {
+            X509 *peer = SSL_get1_peer_certificate(ssl);
+            if (peer != nullptr)
+            {
+                cert = EVP_PKEY_get_base_id(X509_get0_pubkey(peer)) == EVP_PKEY_RSA ? "RSA" : "EC";
+                X509_free(peer);
+            }
+            cipher = SSL_get_cipher_name(ssl);
+
+            std::vector<char> chunk(16 * 1024, 'b');
+            auto bulk_start = std::chrono::steady_clock::now();
+            size_t sent = 0;
+            while (sent < BULK_BYTES && SSL_write(ssl, chunk.data(), chunk.size()) > 0)
+                sent += chunk.size();
+            double bulk_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - bulk_start).count();
+            mb_per_s = sent / 1048576.0 / bulk_seconds;
+            close_tls(ssl);
+        }
+        SSL_CTX_free(client_ctx);
+
+        std::cout << std::left << std::setw(28) << c.name << std::setw(6) << cert << std::setw(30) << cipher
+                  << std::right << std::fixed << std::setprecision(0) << std::setw(12) << count / elapsed
+                  << std::setw(14) << (count > 0 ? cpu * 1e6 / count : 0) << std::setw(10) << mb_per_s << std::endl;
+    }
+
+    for (const auto &name : {"rsa4096", "rsa2048", "p256"})
+    {
+        unlink((dir + "/" + name + ".crt").c_str());
+        unlink((dir + "/" + name + ".key").c_str());
+    }
+    rmdir(dir.c_str());
+    return 0;
+}
@@ -0,0 +1,272 @@
+// Latency effect of the listener socket options (loopback)
+// (C) Anatoly Mazkun, buy me a beer, 2025
+//
+// Every option set runs the same two scenarios against an in-process server:
+//  - keepalive: one connection, request and response are each sent in two
+//    small writes (headers, body). That is the pattern where Nagle on one side
+//    meets delayed ACK on the other side.
+//  - connect: a new connection per request, the request goes with the first
+//    write (or in the SYN when fast open is on).
+// Prints p50 / p99 / max latency in microseconds.
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include "../common/socket_options.hpp"
+
+static const char REQUEST_HEAD[] = "POST /data HTTP/1.1\r\nHost: localhost\r\nContent-Length: 16\r\n\r\n";
+static const char REQUEST_BODY[] = "{\"name\":\"bench\"}";
+static const char RESPONSE_HEAD[] = "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Length: 12\r\n\r\n";
+static const char RESPONSE_BODY[] = "Hello world!";
+
+static const size_t REQUEST_SIZE = sizeof(REQUEST_HEAD) - 1 + sizeof(REQUEST_BODY) - 1;
+static const size_t RESPONSE_SIZE = sizeof(RESPONSE_HEAD) - 1 + sizeof(RESPONSE_BODY) - 1;
+
+// Read exactly size bytes, false on EOF or error
+static bool read_full(int fd, char *buffer, size_t size)
+{
+    size_t done = 0;
+    while (done < size)
+    {
+        ssize_t n = recv(fd, buffer + done, size - done, 0);
+        if (n <= 0)
+            return false;
+        done += n;
+    }
+    return true;
+}
+
+// Minimal server: one connection at a time, answers every request in two writes
+class BenchServer
+{
+public:
+    BenchServer(const SocketOptions &options) : options(options)
+    {
+        listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+        int reuse = 1;
+        setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        apply_listen_options(listen_fd, options);
+
+        struct sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.sin_port = 0; // Any free port
+        if (bind(listen_fd, (struct sockaddr *)&address, sizeof(address)) < 0 || listen(listen_fd, 128) < 0)
+        {
+            perror("Bench server bind/listen failed");
+            exit(EXIT_FAILURE);
+        }
+        socklen_t len = sizeof(address);
+        getsockname(listen_fd, (struct sockaddr *)&address, &len);
+        port = ntohs(address.sin_port);
+
+        worker = std::thread([this]
+                             { serve(); });
+    }
+
+    ~BenchServer()
+    {
+        stop = true;
+        shutdown(listen_fd, SHUT_RDWR);
+        close(listen_fd);
+        worker.join();
+    }
+
+    int port = 0;
+
+private:
+    SocketOptions options;
+    int listen_fd = -1;
+    std::atomic<bool> stop{false};
+    std::thread worker;
+
+    void serve()
+    {
+        char buffer[REQUEST_SIZE];
+        while (!stop)
+        {
+            int client = accept(listen_fd, nullptr, nullptr);
+            if (client < 0)
+                continue;
+            apply_client_options(client, options);
+            while (true)
+            {
+                rearm_quickack(client, options);
+                if (!read_full(client, buffer, REQUEST_SIZE))
+                    break;
+                send(client, RESPONSE_HEAD, sizeof(RESPONSE_HEAD) - 1, 0);
+                send(client, RESPONSE_BODY, sizeof(RESPONSE_BODY) - 1, 0);
+            }
+            close(client);
+        }
+    }
+};
+
+static struct sockaddr_in loopback(int port)
+{
+    struct sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(port);
+    return address;
+}
+
+// Same connection, request and response in two writes each
+static std::vector<double> bench_keepalive(int port, int iterations)
+{
+    std::vector<double> samples;
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in address = loopback(port);
+    if (connect(fd, (struct sockaddr *)&address, sizeof(address)) < 0)
+    {
+        perror("Bench connect failed");
+        close(fd);
+        return samples;
+    }
+
+    char buffer[RESPONSE_SIZE];
+    for (int i = 0; i < iterations; i++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        send(fd, REQUEST_HEAD, sizeof(REQUEST_HEAD) - 1, 0);
+        send(fd, REQUEST_BODY, sizeof(REQUEST_BODY) - 1, 0);
+        if (!read_full(fd, buffer, RESPONSE_SIZE))
+            break;
+        samples.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+    }
+    close(fd);
+    return samples;
+}
+
+// Connect and send the request, with fast open the data rides in the SYN
+static ssize_t send_request(int fd, const std::string &request, const struct sockaddr_in &address, bool fastopen)
+{
+#ifdef MSG_FASTOPEN
+    if (fastopen)
+        return sendto(fd, request.data(), request.size(), MSG_FASTOPEN, (const struct sockaddr *)&address, sizeof(address));
+#else
+    (void)fastopen;
+#endif
+    if (connect(fd, (const struct sockaddr *)&address, sizeof(address)) < 0)
+        return -1;
+    return send(fd, request.data(), request.size(), 0);
+}
+
+// New connection per request, fast open puts the request into the SYN
+static std::vector<double> bench_connect(int port, int iterations, bool fastopen)
+{
+    std::vector<double> samples;
+    std::string request = std::string(REQUEST_HEAD) + REQUEST_BODY;
+    char buffer[RESPONSE_SIZE];
+    struct sockaddr_in address = loopback(port);
+
+    for (int i = 0; i < iterations; i++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        ssize_t sent = send_request(fd, request, address, fastopen);
+
+        bool ok = sent == (ssize_t)request.size() && read_full(fd, buffer, RESPONSE_SIZE);
+        close(fd);
+        if (!ok)
+            continue;
+        samples.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+    }
+    return samples;
+}
+
+// net.ipv4.tcp_fastopen: 1 client, 2 server. Without the server bit the
+// listener ignores TCP_FASTOPEN and the case would time a plain connect.
+static int fastopen_sysctl()
+{
+    std::ifstream file("/proc/sys/net/ipv4/tcp_fastopen");
+    int value = 0;
+    file >> value;
+    return value;
+}
+
+static void report(const std::string &name, const std::string &scenario, std::vector<double> samples)
+{
+    std::cout << std::left << std::setw(24) << name << std::setw(11) << scenario;
+    if (samples.empty())
+    {
+        std::cout << "no samples" << std::endl;
+        return;
+    }
+    std::sort(samples.begin(), samples.end());
+    auto at = [&samples](double q)
+    { return samples[std::min(samples.size() - 1, (size_t)(q * samples.size()))]; };
+    std::cout << std::right << std::fixed << std::setprecision(1)
+              << std::setw(10) << at(0.50)
+              << std::setw(10) << at(0.99)
+              << std::setw(10) << samples.back()
+              << std::setw(8) << samples.size() << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+    int iterations = argc > 1 ? std::atoi(argv[1]) : 200;
+
+    struct Case
+    {
+        std::string name;
+        SocketOptions options;
+    };
+    std::vector<Case> cases(8);
+    cases[0].name = "defaults";
+    cases[1].name = "tcp_nodelay";
+    cases[1].options.tcp_nodelay = true;
+    cases[2].name = "quickack";
+    cases[2].options.quickack = true;
+    cases[3].name = "nodelay+quickack";
+    cases[3].options.tcp_nodelay = true;
+    cases[3].options.quickack = true;
+    cases[4].name = "defer_accept=1";
+    cases[4].options.defer_accept = 1;
+    // Over nodelay+quickack: alone it would time the Nagle / delayed ACK stall
+    cases[5].name = "nodelay+quickack+tfo";
+    cases[5].options = cases[3].options;
+    cases[5].options.fastopen_queue = 256;
+    cases[6].name = "snd/rcvbuf=256k";
+    cases[6].options.sndbuf = 256 * 1024;
+    cases[6].options.rcvbuf = 256 * 1024;
+    cases[7].name = "busy_poll=50";
+    cases[7].options.busy_poll = 50;
+
+    std::cout << "Iterations per scenario: " << iterations << ", latency in microseconds" << std::endl;
+    std::cout << std::left << std::setw(24) << "options" << std::setw(11) << "scenario" << std::right
+              << std::setw(10) << "p50" << std::setw(10) << "p99" << std::setw(10) << "max" << std::setw(8) << "n" << std::endl;
+
+    int fastopen = fastopen_sysctl();
+    for (const auto &c : cases)
+    {
+        if (c.options.fastopen_queue > 0 && !(fastopen & 2))
+        {
+            std::cout << std::left << std::setw(24) << c.name << "skipped, net.ipv4.tcp_fastopen=" << fastopen
+                      << " has no server bit (2)" << std::endl;
+            continue;
+        }
+        BenchServer server(c.options);
+        report(c.name, "keepalive", bench_keepalive(server.port, iterations));
+        report(c.name, "connect", bench_connect(server.port, iterations, c.options.fastopen_queue > 0));
+    }
+    if ((fastopen & 3) != 3)
+        std::cout << "Fast open needs net.ipv4.tcp_fastopen=3 on the host, the client bit (1) to send data in the SYN." << std::endl;
+    return 0;
+}
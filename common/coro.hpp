@@ -0,0 +1,138 @@
+//
+//  coro.hpp
+//
+//  Minimal C++20 coroutine types for request handlers:
+//  task<T>  - lazy coroutine, starts when awaited, resumes its awaiter when done
+//  spawn()  - runs a task from plain code and hands its result to a callback
+//
+
+#ifndef coro_hpp
+#define coro_hpp
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+
+template <typename T>
+class task;
+
+namespace detail
+{
+    // Promise parts shared by task<T> and task<void>
+    struct task_promise_base
+    {
+        std::coroutine_handle<> continuation;
+        std::exception_ptr error;
+
+        // Symmetric transfer to the awaiter, no stack growth on long chains
+        struct final_awaiter
+        {
+            bool await_ready() noexcept { return false; }
+            template <typename Promise>
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> done) noexcept
+            {
+                auto next = done.promise().continuation;
+                return next ? next : std::noop_coroutine();
+            }
+            void await_resume() noexcept {}
+        };
+
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        final_awaiter final_suspend() noexcept { return {}; }
+        void unhandled_exception() { error = std::current_exception(); }
+    };
+
+    template <typename T>
+    struct task_promise : task_promise_base
+    {
+        std::optional<T> value;
+
+        task<T> get_return_object();
+        void return_value(T result) { value = std::move(result); }
+        T result()
+        {
+            if (error)
+                std::rethrow_exception(error);
+            return std::move(*value);
+        }
+    };
+
+    template <>
+    struct task_promise<void> : task_promise_base
+    {
+        task<void> get_return_object();
+        void return_void() {}
+        void result()
+        {
+            if (error)
+                std::rethrow_exception(error);
+        }
+    };
+}
+
+template <typename T = void>
+class task
+{
+public:
+    using promise_type = detail::task_promise<T>;
+    using handle_type = std::coroutine_handle<promise_type>;
+
+    explicit task(handle_type handle) : handle(handle) {}
+    task(task &&other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+    task(const task &) = delete;
+    task &operator=(const task &) = delete;
+    ~task()
+    {
+        if (handle)
+            handle.destroy();
+    }
+
+    bool await_ready() const noexcept { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+    {
+        handle.promise().continuation = awaiting;
+        return handle; // Start the task
+    }
+    T await_resume() { return handle.promise().result(); }
+
+private:
+    handle_type handle;
+};
+
+namespace detail
+{
+    template <typename T>
+    task<T> task_promise<T>::get_return_object()
+    {
+        return task<T>(std::coroutine_handle<task_promise<T>>::from_promise(*this));
+    }
+
+    inline task<void> task_promise<void>::get_return_object()
+    {
+        return task<void>(std::coroutine_handle<task_promise<void>>::from_promise(*this));
+    }
+
+    // Fire and forget coroutine, the frame frees itself at the end
+    struct detached
+    {
+        struct promise_type
+        {
+            detached get_return_object() noexcept { return {}; }
+            std::suspend_never initial_suspend() noexcept { return {}; }
+            std::suspend_never final_suspend() noexcept { return {}; }
+            void return_void() noexcept {}
+            void unhandled_exception() noexcept { std::terminate(); }
+        };
+    };
+}
+
+// Start a task from plain code. done(result) runs on the thread that
+// finished the task; exceptions must be handled inside the task.
+template <typename T, typename Done>
+detail::detached spawn(task<T> work, Done done)
+{
+    done(co_await work);
+}
+
+#endif /* coro_hpp */
@@ -0,0 +1,222 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <map>
+#include <algorithm>
+#include <cstring>
+#include <thread>
+
+#ifdef __linux__
+#include <sched.h>
+#include <pthread.h>
+#endif
+#include <sys/socket.h>
+
+#include "cpu_topology.hpp"
+#include "parsing.hpp"
+
+std::vector<int> available_cpus()
+{
+    std::vector<int> cpus;
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0)
+    {
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+            if (CPU_ISSET(cpu, &set))
+                cpus.push_back(cpu);
+    }
+#endif
+    if (cpus.empty())
+    {
+        int count = std::max(1u, std::thread::hardware_concurrency());
+        for (int cpu = 0; cpu < count; cpu++)
+            cpus.push_back(cpu);
+    }
+    return cpus;
+}
+
+// Cgroup of the process from /proc/self/cgroup: the v2 line "0::/path" when
+// controller is empty, else the v1 line listing it, "4:cpu,cpuacct:/path"
+static std::string process_cgroup(const std::string &controller)
+{
+    std::ifstream in("/proc/self/cgroup");
+    for (std::string line; std::getline(in, line);)
+    {
+        size_t first = line.find(':');
+        size_t second = line.find(':', first + 1);
+        if (first == std::string::npos || second == std::string::npos)
+            continue;
+        const std::string controllers = "," + line.substr(first + 1, second - first - 1) + ",";
+        if (controller.empty() ? controllers == ",," : controllers.find("," + controller + ",") != std::string::npos)
+            return line.substr(second + 1);
+    }
+    return "/";
+}
+
+// CPUs granted by the cgroup quota (v2 cpu.max, v1 cfs quota), 0 if unlimited.
+// The quota of every cgroup from the process's own up to the root applies, the smallest wins.
+static int cgroup_cpu_limit()
+{
+    const bool v2 = std::ifstream("/sys/fs/cgroup/cgroup.controllers").good();
+    const std::string mount = v2 ? "/sys/fs/cgroup" : "/sys/fs/cgroup/cpu";
+    std::string path = process_cgroup(v2 ? "" : "cpu");
+
+    int limit = 0;
+    while (true)
+    {
+        const std::string dir = mount + (path == "/" ? "" : path);
+        long long quota = -1, period = 0;
+        if (v2)
+        {
+            std::ifstream cpu_max(dir + "/cpu.max");
+            std::string max;
+            if (cpu_max >> max >> period && max != "max")
+                quota = std::stoll(max);
+        }
+        else
+        {
+            std::ifstream v1_quota(dir + "/cpu.cfs_quota_us");
+            std::ifstream v1_period(dir + "/cpu.cfs_period_us");
+            if (!(v1_quota >> quota) || !(v1_period >> period))
+                quota = -1;
+        }
+        if (quota > 0 && period > 0)
+        {
+            int cpus = (int)((quota + period - 1) / period); // Round up, a 1.5 CPU quota still keeps 2 threads busy
+            if (limit == 0 || cpus < limit)
+                limit = cpus;
+        }
+
+        // In a cgroup namespace the path is "/" and the mount is the process's own cgroup
+        size_t slash = path.rfind('/');
+        if (path.empty() || path == "/" || slash == std::string::npos)
+            break;
+        path = slash == 0 ? "/" : path.substr(0, slash);
+    }
+    return limit;
+}
+
+int default_worker_count()
+{
+    int count = (int)available_cpus().size();
+    int limit = cgroup_cpu_limit();
+    if (limit > 0 && limit < count)
+        count = limit;
+    return count;
+}
+
+// Parse a sysfs CPU list like "0-3,8-11"
+static std::vector<int> parse_cpu_list(const std::string &list)
+{
+    std::vector<int> cpus;
+    std::stringstream ss(list);
+    for (std::string range; std::getline(ss, range, ',');)
+    {
+        if (!not_blank(range))
+            continue;
+        size_t dash = range.find('-');
+        int first = std::stoi(range.substr(0, dash));
+        int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+        for (int cpu = first; cpu <= last; cpu++)
+            cpus.push_back(cpu);
+    }
+    return cpus;
+}
+
+int cpu_numa_node(int cpu)
+{
+    // Node lists are small, read them once
+    static const std::map<int, int> node_of_cpu = []
+    {
+        std::map<int, int> nodes;
+        for (int node = 0; node < 1024; node++)
+        {
+            std::ifstream cpulist("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+            if (!cpulist)
+            {
+                if (node > 0 && nodes.empty())
+                    break;
+                continue;
+            }
+            std::string list;
+            std::getline(cpulist, list);
+            for (int c : parse_cpu_list(list))
+                nodes[c] = node;
+        }
+        return nodes;
+    }();
+
+    auto found = node_of_cpu.find(cpu);
+    return found == node_of_cpu.end() ? 0 : found->second;
+}
+
+std::vector<std::vector<int>> numa_groups(const std::vector<int> &cpus)
+{
+    std::map<int, std::vector<int>> by_node;
+    for (int cpu : cpus)
+        by_node[cpu_numa_node(cpu)].push_back(cpu);
+
+    std::vector<std::vector<int>> groups;
+    for (auto &node : by_node)
+        groups.push_back(std::move(node.second));
+    return groups;
+}
+
+bool pin_current_thread(const std::vector<int> &cpus)
+{
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus)
+        CPU_SET(cpu, &set);
+    int error = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (error != 0)
+    {
+        std::cerr << time_stamp() << " Pin thread failed: " << strerror(error) << std::endl;
+        return false;
+    }
+    return true;
+#else
+    (void)cpus;
+    return false;
+#endif
+}
+
+int socket_incoming_cpu(int fd)
+{
+#ifdef SO_INCOMING_CPU
+    int cpu = -1;
+    socklen_t len = sizeof(cpu);
+    if (getsockopt(fd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &len) == 0)
+        return cpu;
+#else
+    (void)fd;
+#endif
+    return -1;
+}
+
+bool parse_worker_option(const std::string &arg, WorkerOptions &options)
+{
+    if (arg == "--pin-workers")
+        options.pin_workers = true;
+    else if (arg == "--numa")
+        options.numa = true;
+    else if (!parse_int_arg(arg, "--workers", options.workers) &&
+             !parse_int_arg(arg, "--io-threads", options.io_threads) &&
+             !parse_int_arg(arg, "--pin-acceptor", options.acceptor_cpu))
+        return false;
+    return true;
+}
+
+std::string worker_options_usage()
+{
+    return "Worker options:\n"
+           "\t--workers=<n>\t\tworker threads, default: available cores\n"
+           "\t--io-threads=<n>\tevent loop threads (HTTPS), default: as workers\n"
+           "\t--pin-workers\t\tpin every worker to one core\n"
+           "\t--pin-acceptor=<cpu>\tpin the accepting thread\n"
+           "\t--numa\t\t\tone worker group per NUMA node\n";
+}
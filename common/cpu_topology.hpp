@@ -0,0 +1,31 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Worker threads layout. Defaults keep the old behaviour: one pool, threads float.
+struct WorkerOptions
+{
+    int workers = 0;          // 0: CPUs available to the process (affinity mask and cgroup quota)
+    int io_threads = 0;       // Event loop threads, 0: same as workers
+    bool pin_workers = false; // Pin every worker to a single core
+    int acceptor_cpu = -1;    // Pin the accepting thread to this core
+    bool numa = false;        // One worker group per NUMA node, connections served on the node they arrived at
+};
+
+// CPUs in the affinity mask of the process
+std::vector<int> available_cpus();
+// Worker count for this process: affinity mask limited by the cgroup CPU quota
+int default_worker_count();
+// NUMA node of a CPU, 0 if unknown
+int cpu_numa_node(int cpu);
+// Split CPUs by NUMA node, nodes in ascending order
+std::vector<std::vector<int>> numa_groups(const std::vector<int> &cpus);
+// Restrict the calling thread to the given CPUs
+bool pin_current_thread(const std::vector<int> &cpus);
+// CPU that handled the last packets of a connected socket, -1 if unknown
+int socket_incoming_cpu(int fd);
+
+// Parse one command line argument like "--workers=8" or "--numa"
+bool parse_worker_option(const std::string &arg, WorkerOptions &options);
+std::string worker_options_usage();
@@ -0,0 +1,181 @@
+//
+//  event_loop.cpp
+//
+#include <iostream>
+#include <chrono>
+#include <cerrno>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "event_loop.hpp"
+#include "cpu_topology.hpp"
+#include "parsing.hpp"
+
+#define MAX_EVENTS 64
+
+static int64_t now_ms()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+EventLoop::EventLoop(const std::vector<int> &cpus)
+{
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epoll_fd < 0 || wake_fd < 0)
+    {
+        perror((time_stamp() + " Event loop creation failed").c_str());
+        exit(EXIT_FAILURE);
+    }
+
+    struct epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.fd = wake_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &event);
+
+    thread = std::thread([this, cpus]
+                         {
+        if (!cpus.empty())
+            pin_current_thread(cpus);
+        loop(); });
+}
+
+EventLoop::~EventLoop()
+{
+    stop = true;
+    uint64_t one = 1;
+    if (write(wake_fd, &one, sizeof(one)) < 0)
+        perror((time_stamp() + " Event loop wake failed").c_str());
+    thread.join();
+
+    close(wake_fd);
+    close(epoll_fd);
+}
+
+void EventLoop::add(int fd, uint32_t events, Callback callback)
+{
+    handlers[fd] = std::make_shared<Callback>(std::move(callback));
+
+    struct epoll_event event = {};
+    event.events = events;
+    event.data.fd = fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0)
+        perror((time_stamp() + " epoll add failed").c_str());
+}
+
+void EventLoop::modify(int fd, uint32_t events)
+{
+    struct epoll_event event = {};
+    event.events = events;
+    event.data.fd = fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &event) < 0)
+        perror((time_stamp() + " epoll modify failed").c_str());
+}
+
+void EventLoop::remove(int fd)
+{
+    handlers.erase(fd);
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+}
+
+void EventLoop::post(std::function<void()> task)
+{
+    {
+        std::lock_guard<std::mutex> guard(posted_mutex);
+        posted.push_back(std::move(task));
+    }
+    uint64_t one = 1;
+    if (write(wake_fd, &one, sizeof(one)) < 0)
+        perror((time_stamp() + " Event loop wake failed").c_str());
+}
+
+uint64_t EventLoop::add_timer(int delay_ms, std::function<void()> task)
+{
+    uint64_t id = next_timer_id++;
+    auto it = timers.emplace(now_ms() + delay_ms, Timer{id, std::move(task)});
+    timer_index[id] = it;
+    return id;
+}
+
+void EventLoop::cancel_timer(uint64_t id)
+{
+    auto found = timer_index.find(id);
+    if (found == timer_index.end())
+        return;
+    timers.erase(found->second);
+    timer_index.erase(found);
+}
+
+bool EventLoop::in_loop_thread() const
+{
+    return std::this_thread::get_id() == thread.get_id();
+}
+
+// epoll_wait timeout: until the next timer, forever if there is none
+int EventLoop::next_timeout_ms()
+{
+    if (timers.empty())
+        return -1;
+    int64_t delay = timers.begin()->first - now_ms();
+    return delay < 0 ? 0 : (int)delay;
+}
+
+void EventLoop::run_timers()
+{
+    int64_t now = now_ms();
+    while (!timers.empty() && timers.begin()->first <= now)
+    {
+        Timer timer = std::move(timers.begin()->second);
+        timers.erase(timers.begin());
+        timer_index.erase(timer.id);
+        timer.task();
+    }
+}
+
+void EventLoop::run_posted()
+{
+    std::vector<std::function<void()>> tasks;
+    {
+        std::lock_guard<std::mutex> guard(posted_mutex);
+        tasks.swap(posted);
+    }
+    for (auto &task : tasks)
+        task();
+}
+
+void EventLoop::loop()
+{
+    struct epoll_event events[MAX_EVENTS];
+    while (!stop)
+    {
+        int count = epoll_wait(epoll_fd, events, MAX_EVENTS, next_timeout_ms());
+        if (count < 0 && errno != EINTR)
+        {
+            perror((time_stamp() + " epoll wait failed").c_str());
+            break;
+        }
+
+        for (int i = 0; i < count; i++)
+        {
+            int fd = events[i].data.fd;
+            if (fd == wake_fd)
+            {
+                uint64_t value;
+                while (read(wake_fd, &value, sizeof(value)) > 0)
+                    ;
+                continue;
+            }
+
+            auto found = handlers.find(fd);
+            if (found == handlers.end())
+                continue; // Removed by an earlier callback of this batch
+            std::shared_ptr<Callback> callback = found->second;
+            (*callback)(events[i].events);
+        }
+
+        run_posted();
+        run_timers();
+    }
+}
@@ -0,0 +1,74 @@
+//
+//  event_loop.hpp
+//
+//  Single threaded epoll loop: socket readiness, cross thread posts and timers.
+//  add / modify / remove / add_timer / cancel_timer must be called on the loop
+//  thread, post() from anywhere.
+//
+
+#ifndef event_loop_hpp
+#define event_loop_hpp
+
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <memory>
+#include <functional>
+#include <cstdint>
+
+class EventLoop
+{
+public:
+    using Callback = std::function<void(uint32_t events)>;
+
+    // Starts the loop thread, pinned to the given CPUs if any
+    EventLoop(const std::vector<int> &cpus = std::vector<int>());
+
+    // Stops the loop thread, registered sockets are not closed
+    ~EventLoop();
+
+    // Watch a socket, callback gets the epoll events
+    void add(int fd, uint32_t events, Callback callback);
+    void modify(int fd, uint32_t events);
+    void remove(int fd);
+
+    // Run a task on the loop thread, thread safe
+    void post(std::function<void()> task);
+
+    // Run a task on the loop thread after the delay
+    uint64_t add_timer(int delay_ms, std::function<void()> task);
+    void cancel_timer(uint64_t id);
+
+    bool in_loop_thread() const;
+
+private:
+    void loop();
+    int next_timeout_ms();
+    void run_timers();
+    void run_posted();
+
+    int epoll_fd = -1;
+    int wake_fd = -1; // eventfd, wakes epoll_wait for posted tasks
+    std::atomic<bool> stop{false};
+    std::thread thread;
+
+    // Shared so a callback can remove its own socket while it runs
+    std::unordered_map<int, std::shared_ptr<Callback>> handlers;
+
+    std::mutex posted_mutex;
+    std::vector<std::function<void()>> posted;
+
+    struct Timer
+    {
+        uint64_t id;
+        std::function<void()> task;
+    };
+    std::multimap<int64_t, Timer> timers; // Deadline in ms of steady clock
+    std::unordered_map<uint64_t, std::multimap<int64_t, Timer>::iterator> timer_index;
+    uint64_t next_timer_id = 1;
+};
+
+#endif /* event_loop_hpp */
@@ -0,0 +1,51 @@
+#include <algorithm>
+
+#include "routes.hpp"
+#include "handlers.hpp"
+
+// Read the rest of the body into body, false if the client went away
+task<bool> Request::read_body()
+{
+    while (body.size() < content_length)
+    {
+        std::string chunk = co_await read();
+        if (chunk.empty())
+            co_return false;
+        body += chunk;
+    }
+    co_return true;
+}
+
+// GET /delay/<ms>: answers after a timer, a waiting request holds no thread
+task<Response> delay_handler(Request &request)
+{
+    int delay = 0;
+    try
+    {
+        delay = std::clamp(std::stoi(request.tokens.at(2)), 0, 10000);
+    }
+    catch (const std::exception &e)
+    {
+        // No or bad number: answer at once
+    }
+
+    co_await request.sleep(delay);
+    co_return Response{200, RESPONSE_STUB + "Delayed " + std::to_string(delay) + " ms", false};
+}
+
+// POST /echo: streams the body back while it arrives
+task<Response> echo_handler(Request &request)
+{
+    bool ok = co_await request.write("HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\nContent-Length: " +
+                                     std::to_string(request.content_length) + "\r\nConnection: close\r\n\r\n");
+    size_t echoed = 0;
+    while (ok && echoed < request.content_length)
+    {
+        std::string chunk = co_await request.read();
+        if (chunk.empty())
+            break;
+        echoed += chunk.size();
+        ok = co_await request.write(std::move(chunk));
+    }
+    co_return Response{200, "", true};
+}
@@ -39,6 +39,10 @@ std::string GET_handler(const std::vector<std::string> &request)
     {
         return "";
     }
+    else if (cmd == "health")
+    {
+        return RESPONSE_STUB + "OK";
+    }
     else if (cmd == "json")
     {
         // Example data handling (replace with your logic)
@@ -47,7 +51,7 @@ std::string GET_handler(const std::vector<std::string> &request)
     else if (cmd == "http" || cmd == "help")
     {
         // Example data handling (replace with your logic)
-        return RESPONSE_STUB + "Endpoints:\n\t/hello\n\t/hello/<number>\n\t/data - POST {\"name\":\"Bilya\",\"age\":24}\n\t/lucky\n\t/json\n\t/add/<a>/<b>\n\t/stop";
+        return RESPONSE_STUB + "Endpoints:\n\t/hello\n\t/hello/<number>\n\t/data - POST {\"name\":\"Bilya\",\"age\":24}\n\t/lucky\n\t/json\n\t/add/<a>/<b>\n\t/health\n\t/stop";
     }
     return NOT_IMPLEMENTED;
 }
@@ -11,6 +11,5 @@ const std::string NOT_IMPLEMENTED = "HTTP/1.1 501 Not Implemented\r\nContent-Typ
 const std::string RESPONSE_STUB = "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\n\r\n";
 
 // Handle requests
-void handle_client(SSL *ssl);
 std::string GET_handler(const std::vector<std::string> &request);
 std::string POST_handler(const std::vector<std::string> &request);
@@ -1,8 +1,13 @@
 #include <regex>
+#include <algorithm>
+#include <chrono>
 #include <string>
+#include <string_view>
 #include <ctime>
 #include <iomanip>
 #include <sstream>
+#include <iostream>
+#include <cstdlib>
 #include "parsing.hpp"
 
 std::string time_stamp()
@@ -48,3 +53,83 @@ std::vector<std::string> split(const std::string &s)
     }
     return tokens;
 }
+
+// Parse "--name=value" into value, returns false if the name does not match
+// or the value is not a whole number of at least min (value is unchanged then)
+bool parse_int_arg(const std::string &arg, const std::string &name, int &value, int min)
+{
+    const std::string prefix = name + "=";
+    if (arg.compare(0, prefix.size(), prefix) != 0)
+        return false;
+    const std::string text = arg.substr(prefix.size());
+    size_t end = 0;
+    int parsed = 0;
+    try
+    {
+        parsed = std::stoi(text, &end);
+    }
+    catch (const std::exception &)
+    {
+        end = 0; // Not a number or out of range
+    }
+    if (end == 0 || end != text.size() || parsed < min)
+    {
+        std::cerr << time_stamp() << " Bad value in " << arg << ": expected a whole number from " << min << std::endl;
+        return false;
+    }
+    value = parsed;
+    return true;
+}
+
+// Parse "--name=text" into value, returns false if the name does not match
+bool parse_string_arg(const std::string &arg, const std::string &name, std::string &value)
+{
+    const std::string prefix = name + "=";
+    if (arg.compare(0, prefix.size(), prefix) != 0)
+        return false;
+    value = arg.substr(prefix.size());
+    return true;
+}
+
+// Length of the request head up to and with the blank line, 0 while it is incomplete
+size_t head_length(std::string_view buffer)
+{
+    size_t header_end = buffer.find("\r\n\r\n");
+    return header_end == std::string_view::npos ? 0 : header_end + 4;
+}
+
+// Content-Length of a request head, 0 if there is none
+size_t content_length(const std::string &head)
+{
+    const std::string name = "\r\ncontent-length:";
+    std::string headers = str_tolower(head);
+    size_t pos = headers.find(name);
+    if (pos == std::string::npos)
+        return 0;
+    return std::strtoul(headers.c_str() + pos + name.size(), nullptr, 10);
+}
+
+// HTTP/1.1 keeps the connection unless "Connection: close",
+// HTTP/1.0 only with "Connection: keep-alive"
+bool keep_alive_requested(const std::string &request)
+{
+    std::string headers = str_tolower(request.substr(0, request.find("\r\n\r\n")));
+    if (headers.substr(0, headers.find("\r\n")).find("http/1.0") != std::string::npos)
+        return headers.find("\r\nconnection: keep-alive") != std::string::npos;
+    return headers.find("\r\nconnection: close") == std::string::npos;
+}
+
+// Handlers return complete responses without framing, add
+// Content-Length and Connection so the connection can be reused
+std::string frame_response(const std::string &response, bool keep_alive)
+{
+    size_t header_end = response.find("\r\n\r\n");
+    if (header_end == std::string::npos)
+        return response;
+
+    size_t body = response.size() - header_end - 4;
+    return response.substr(0, header_end) +
+           "\r\nContent-Length: " + std::to_string(body) +
+           (keep_alive ? "\r\nConnection: keep-alive" : "\r\nConnection: close") +
+           response.substr(header_end);
+}
@@ -2,8 +2,18 @@
 
 #include <vector>
 #include <string>
+#include <string_view>
 
 std::vector<std::string> split(const std::string &s);
 bool not_blank(const std::string &s);
 std::string str_tolower(std::string s);
-std::string time_stamp();
\ No newline at end of file
+std::string time_stamp();
+// Parse "--name=value" into value, returns false if the name does not match or the value is bad
+bool parse_int_arg(const std::string &arg, const std::string &name, int &value, int min = 0);
+bool parse_string_arg(const std::string &arg, const std::string &name, std::string &value);
+// Length of the request head, 0 while it is incomplete
+size_t head_length(std::string_view buffer);
+size_t content_length(const std::string &head);
+bool keep_alive_requested(const std::string &request);
+// Add Content-Length and Connection headers to a handler response
+std::string frame_response(const std::string &response, bool keep_alive);
@@ -0,0 +1,44 @@
+#include "routes.hpp"
+
+// Route table. Cheap handlers run inline on the I/O thread with no handoff,
+// heavy ones go to the compute pool in their priority class. Health and
+// metrics are inline, they never queue behind the pool so they answer under
+// load. Coroutine handlers start on the I/O thread and offload work themselves.
+static constexpr Route ROUTES[] = {
+    {"get", "health", COST_INLINE, PRIORITY_NORMAL, nullptr},
+    {"get", "metrics", COST_INLINE, PRIORITY_NORMAL, nullptr},
+    {"get", "stop", COST_INLINE, PRIORITY_NORMAL, nullptr},
+    {"get", "hello", COST_INLINE, PRIORITY_NORMAL, nullptr},
+    {"get", "add", COST_INLINE, PRIORITY_NORMAL, nullptr},
+    {"get", "json", COST_INLINE, PRIORITY_NORMAL, nullptr},
+    {"get", "help", COST_INLINE, PRIORITY_NORMAL, nullptr},
+    {"get", "http", COST_INLINE, PRIORITY_NORMAL, nullptr},
+    {"get", "trace", COST_HEAVY, PRIORITY_LOW, nullptr},
+    {"post", "data", COST_HEAVY, PRIORITY_NORMAL, nullptr},
+    {"get", "delay", COST_INLINE, PRIORITY_NORMAL, delay_handler},
+    {"post", "echo", COST_INLINE, PRIORITY_NORMAL, echo_handler},
+};
+
+// Inline routes are never queued, a priority other than the default would mean nothing
+static constexpr bool inline_routes_unprioritized()
+{
+    for (const auto &route : ROUTES)
+        if (route.cost == COST_INLINE && route.priority != PRIORITY_NORMAL)
+            return false;
+    return true;
+}
+static_assert(inline_routes_unprioritized(), "only offloaded routes carry a priority");
+
+static const Route DEFAULT_ROUTE = {"", "", COST_HEAVY, PRIORITY_LOW, nullptr};
+
+const Route &find_route(const std::vector<std::string> &request)
+{
+    if (request.size() < 2)
+        return DEFAULT_ROUTE;
+    for (const auto &route : ROUTES)
+    {
+        if (request[0] == route.method && request[1] == route.path)
+            return route;
+    }
+    return DEFAULT_ROUTE;
+}
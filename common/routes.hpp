@@ -0,0 +1,112 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <coroutine>
+
+#include "coro.hpp"
+#include "thread_pools.hpp"
+
+// Async I/O of the connection a handler serves, implemented by the server.
+// Completions resume the handler on the connection's event loop. Each call
+// returns false when it completed at once, the handler then goes on without
+// suspending.
+class RequestIo
+{
+public:
+    virtual ~RequestIo() = default;
+    // Next chunk of the request body, empty when the body is complete or the client is gone
+    virtual bool read(std::coroutine_handle<> handler, std::string &chunk) = 0;
+    // Raw bytes to the client, the response is then not framed by the server
+    virtual bool write(std::coroutine_handle<> handler, const std::string &data, bool &ok) = 0;
+    virtual bool sleep(std::coroutine_handle<> handler, int delay_ms) = 0;
+    // Resume on the compute pool, the next read / write / sleep comes back to the event loop
+    virtual bool offload(std::coroutine_handle<> handler, TaskPriority priority) = 0;
+};
+
+struct Request
+{
+    std::vector<std::string> tokens; // split() of the request head, tokens[0] method, tokens[1] path
+    std::string head;                // Request line and headers
+    std::string body;                // Body bytes read so far
+    size_t content_length = 0;
+    RequestIo *io = nullptr;
+
+    struct read_awaitable
+    {
+        RequestIo *io;
+        std::string chunk;
+        bool await_ready() const noexcept { return false; }
+        bool await_suspend(std::coroutine_handle<> handler) { return io->read(handler, chunk); }
+        std::string await_resume() { return std::move(chunk); }
+    };
+
+    struct write_awaitable
+    {
+        RequestIo *io;
+        std::string data;
+        bool ok = false;
+        bool await_ready() const noexcept { return false; }
+        bool await_suspend(std::coroutine_handle<> handler) { return io->write(handler, data, ok); }
+        bool await_resume() const noexcept { return ok; }
+    };
+
+    struct sleep_awaitable
+    {
+        RequestIo *io;
+        int delay_ms;
+        bool await_ready() const noexcept { return delay_ms <= 0; }
+        bool await_suspend(std::coroutine_handle<> handler) { return io->sleep(handler, delay_ms); }
+        void await_resume() const noexcept {}
+    };
+
+    struct offload_awaitable
+    {
+        RequestIo *io;
+        TaskPriority priority;
+        bool await_ready() const noexcept { return false; }
+        bool await_suspend(std::coroutine_handle<> handler) { return io->offload(handler, priority); }
+        void await_resume() const noexcept {}
+    };
+
+    read_awaitable read() { return {io, {}}; }
+    write_awaitable write(std::string data) { return {io, std::move(data)}; }
+    sleep_awaitable sleep(int delay_ms) { return {io, delay_ms}; }
+    offload_awaitable offload(TaskPriority priority = PRIORITY_NORMAL) { return {io, priority}; }
+
+    // Read the rest of the body into body, false if the client went away
+    task<bool> read_body();
+};
+
+struct Response
+{
+    int status = 200;
+    std::string text;      // Complete HTTP response like the synchronous handlers return
+    bool written = false; // The handler wrote the response itself with Request::write
+    bool stop = false;    // Answer, then drain the server (GET /stop)
+};
+
+using AsyncHandler = task<Response> (*)(Request &request);
+
+// How a route is scheduled: inline on the I/O thread, or on the compute pool
+enum HandlerCost
+{
+    COST_INLINE,
+    COST_HEAVY
+};
+
+struct Route
+{
+    const char *method;
+    const char *path;
+    HandlerCost cost;
+    TaskPriority priority;
+    AsyncHandler handler; // nullptr: synchronous GET_handler / POST_handler
+};
+
+// Route of a split request, unknown routes are heavy and low priority
+const Route &find_route(const std::vector<std::string> &request);
+
+// Coroutine handlers
+task<Response> delay_handler(Request &request);
+task<Response> echo_handler(Request &request);
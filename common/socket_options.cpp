@@ -0,0 +1,121 @@
+#include <iostream>
+#include <string>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "socket_options.hpp"
+#include "parsing.hpp"
+
+// setsockopt with an int value, reports failure the same way as the servers do
+static int set_int_option(int fd, int level, int name, int value, const char *label)
+{
+    if (setsockopt(fd, level, name, &value, sizeof(value)) < 0)
+    {
+        perror((time_stamp() + " setsockopt " + label + " failed").c_str());
+        return 1;
+    }
+    return 0;
+}
+
+[[maybe_unused]] static void not_supported(const char *label)
+{
+    std::cerr << time_stamp() << " " << label << " is not supported on this platform, ignored." << std::endl;
+}
+
+int apply_listen_options(int fd, const SocketOptions &options)
+{
+    int failed = 0;
+
+    // Buffer sizes must be set before listen() so the window scale is negotiated with them
+    if (options.sndbuf > 0)
+        failed |= set_int_option(fd, SOL_SOCKET, SO_SNDBUF, options.sndbuf, "SO_SNDBUF");
+    if (options.rcvbuf > 0)
+        failed |= set_int_option(fd, SOL_SOCKET, SO_RCVBUF, options.rcvbuf, "SO_RCVBUF");
+
+    if (options.defer_accept > 0)
+    {
+#ifdef TCP_DEFER_ACCEPT
+        failed |= set_int_option(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, options.defer_accept, "TCP_DEFER_ACCEPT");
+#else
+        not_supported("TCP_DEFER_ACCEPT");
+#endif
+    }
+
+    if (options.fastopen_queue > 0)
+    {
+#ifdef TCP_FASTOPEN
+        failed |= set_int_option(fd, IPPROTO_TCP, TCP_FASTOPEN, options.fastopen_queue, "TCP_FASTOPEN");
+#else
+        not_supported("TCP_FASTOPEN");
+#endif
+    }
+
+    if (options.busy_poll > 0)
+    {
+#ifdef SO_BUSY_POLL
+        failed |= set_int_option(fd, SOL_SOCKET, SO_BUSY_POLL, options.busy_poll, "SO_BUSY_POLL");
+#else
+        not_supported("SO_BUSY_POLL");
+#endif
+    }
+
+    return failed;
+}
+
+int apply_client_options(int fd, const SocketOptions &options)
+{
+    int failed = 0;
+
+    if (options.tcp_nodelay)
+        failed |= set_int_option(fd, IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY");
+
+    if (options.busy_poll > 0)
+    {
+#ifdef SO_BUSY_POLL
+        failed |= set_int_option(fd, SOL_SOCKET, SO_BUSY_POLL, options.busy_poll, "SO_BUSY_POLL");
+#endif
+    }
+
+    rearm_quickack(fd, options);
+    return failed;
+}
+
+void rearm_quickack(int fd, const SocketOptions &options)
+{
+#ifdef TCP_QUICKACK
+    if (options.quickack)
+        set_int_option(fd, IPPROTO_TCP, TCP_QUICKACK, 1, "TCP_QUICKACK");
+#else
+    (void)fd;
+    (void)options;
+#endif
+}
+
+bool parse_socket_option(const std::string &arg, SocketOptions &options)
+{
+    if (arg == "--tcp-nodelay")
+        options.tcp_nodelay = true;
+    else if (arg == "--quickack")
+        options.quickack = true;
+    else if (!parse_int_arg(arg, "--defer-accept", options.defer_accept) &&
+             !parse_int_arg(arg, "--fastopen", options.fastopen_queue) &&
+             !parse_int_arg(arg, "--sndbuf", options.sndbuf) &&
+             !parse_int_arg(arg, "--rcvbuf", options.rcvbuf) &&
+             !parse_int_arg(arg, "--busy-poll", options.busy_poll))
+        return false;
+    return true;
+}
+
+std::string socket_options_usage()
+{
+    return "Socket options:\n"
+           "\t--tcp-nodelay\t\tdisable Nagle on client sockets\n"
+           "\t--defer-accept=<sec>\twake accept() only when request data arrived\n"
+           "\t--fastopen=<qlen>\tenable TCP Fast Open with given queue length\n"
+           "\t--sndbuf=<bytes>\tSO_SNDBUF\n"
+           "\t--rcvbuf=<bytes>\tSO_RCVBUF\n"
+           "\t--quickack\t\tTCP_QUICKACK on client sockets\n"
+           "\t--busy-poll=<usec>\tSO_BUSY_POLL\n";
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <string>
+
+// Socket tuning for one listener. Zero / false leaves the kernel default.
+struct SocketOptions
+{
+    bool tcp_nodelay = false; // TCP_NODELAY on accepted sockets (no Nagle delay for small responses)
+    int defer_accept = 0;     // TCP_DEFER_ACCEPT seconds: accept() wakes only once the client sent data
+    int fastopen_queue = 0;   // TCP_FASTOPEN queue length: data in SYN from repeat clients
+    int sndbuf = 0;           // SO_SNDBUF bytes
+    int rcvbuf = 0;           // SO_RCVBUF bytes
+    bool quickack = false;    // TCP_QUICKACK on accepted sockets (re-armed before each read)
+    int busy_poll = 0;        // SO_BUSY_POLL microseconds
+};
+
+// Apply options to a listening socket, call before bind()/listen()
+int apply_listen_options(int fd, const SocketOptions &options);
+// Apply options to a freshly accepted socket
+int apply_client_options(int fd, const SocketOptions &options);
+// TCP_QUICKACK is not sticky, the kernel clears it after delayed ACKs kick in
+void rearm_quickack(int fd, const SocketOptions &options);
+
+// Parse one command line argument like "--tcp-nodelay" or "--fastopen=256"
+bool parse_socket_option(const std::string &arg, SocketOptions &options);
+std::string socket_options_usage();
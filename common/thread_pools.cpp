@@ -5,6 +5,7 @@
 //  Created by admin on 26.12.2024.
 //
 #include "thread_pools.hpp"
+#include "cpu_topology.hpp"
 
 using namespace std;
 
@@ -15,39 +16,67 @@ ThreadPool::ThreadPool(size_t num_threads)
     // Creating worker threads
     for (size_t i = 0; i < num_threads; ++i)
     {
-        threads_.emplace_back([this]
-                              {
-            while (true) {
-                function<void()> task;
-                // The reason for putting the below code
-                // here is to unlock the queue before
-                // executing the task so that other
-                // threads can perform enqueue tasks
-                {
-                    // Locking the queue so that data
-                    // can be shared safely
-                    unique_lock<mutex> lock(
-                                            queue_mutex_);
-                    
-                    // Waiting until there is a task to
-                    // execute or the pool is stopped
-                    cv_.wait(lock, [this] {
-                        return !tasks_.empty() || stop_;
-                    });
-                    
-                    // exit the thread in case the pool
-                    // is stopped and there are no tasks
-                    if (stop_ && tasks_.empty()) {
-                        return;
-                    }
-                    
-                    // Get the next task from the queue
-                    task = std::move(tasks_.front());
-                    tasks_.pop();
+        threads_.emplace_back(&ThreadPool::worker, this, vector<int>());
+    }
+}
+
+// Constructor to create a thread pool bound to the given
+// CPUs, either the whole set or one CPU per thread
+ThreadPool::ThreadPool(size_t num_threads, const vector<int> &cpus, bool per_core)
+{
+    for (size_t i = 0; i < num_threads; ++i)
+    {
+        vector<int> thread_cpus = cpus;
+        if (per_core && !cpus.empty())
+            thread_cpus = {cpus[i % cpus.size()]};
+        threads_.emplace_back(&ThreadPool::worker, this, std::move(thread_cpus));
+    }
+}
+
+// Worker loop, pins the thread before taking tasks so
+// everything it allocates stays local to its CPUs
+void ThreadPool::worker(vector<int> cpus)
+{
+    if (!cpus.empty())
+        pin_current_thread(cpus);
+
+    while (true) {
+        function<void()> task;
+        // The reason for putting the below code
+        // here is to unlock the queue before
+        // executing the task so that other
+        // threads can perform enqueue tasks
+        {
+            // Locking the queue so that data
+            // can be shared safely
+            unique_lock<mutex> lock(
+                                    queue_mutex_);
+
+            // Waiting until there is a task to
+            // execute or the pool is stopped
+            cv_.wait(lock, [this] {
+                return pending_ > 0 || stop_;
+            });
+
+            // exit the thread in case the pool
+            // is stopped and there are no tasks
+            if (stop_ && pending_ == 0) {
+                return;
+            }
+
+            // Get the next task from the highest
+            // priority queue that has one
+            for (auto &queue : tasks_) {
+                if (!queue.empty()) {
+                    task = std::move(queue.front());
+                    queue.pop();
+                    break;
                 }
-                
-                task();
-            } });
+            }
+            pending_--;
+        }
+
+        task();
     }
 }
 
@@ -73,10 +102,24 @@ ThreadPool::~ThreadPool()
 
 // Enqueue task for execution by the thread pool
 void ThreadPool::enqueue(function<void()> task)
+{
+    enqueue(std::move(task), PRIORITY_NORMAL);
+}
+
+// Enqueue task into the queue of its priority class
+void ThreadPool::enqueue(function<void()> task, TaskPriority priority)
 {
     {
         unique_lock<std::mutex> lock(queue_mutex_);
-        tasks_.emplace(std::move(task));
+        tasks_[priority].emplace(std::move(task));
+        pending_++;
     }
     cv_.notify_one();
 }
+
+// Number of tasks waiting for a thread
+size_t ThreadPool::pending()
+{
+    unique_lock<std::mutex> lock(queue_mutex_);
+    return pending_;
+}
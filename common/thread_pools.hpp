@@ -13,8 +13,20 @@
 
 #include <thread>
 #include <mutex>
+#include <condition_variable>
+#include <queue>
+#include <vector>
 #include <functional>
 
+// Task priority classes, higher classes are always taken first
+enum TaskPriority
+{
+    PRIORITY_HIGH,
+    PRIORITY_NORMAL,
+    PRIORITY_LOW,
+    PRIORITY_COUNT
+};
+
 class ThreadPool
 {
 public:
@@ -22,18 +34,33 @@ public:
     // number of threads
     ThreadPool(size_t num_threads = std::thread::hardware_concurrency());
 
+    // Constructor to create a thread pool bound to the given
+    // CPUs, either the whole set or one CPU per thread
+    ThreadPool(size_t num_threads, const std::vector<int> &cpus, bool per_core);
+
     // Destructor to stop the thread pool
     ~ThreadPool();
 
     // Enqueue task for execution by the thread pool
     void enqueue(std::function<void()> task);
+    void enqueue(std::function<void()> task, TaskPriority priority);
+
+    // Number of tasks waiting for a thread
+    size_t pending();
 
 private:
+    // Worker loop, pins the thread before taking tasks so
+    // everything it allocates stays local to its CPUs
+    void worker(std::vector<int> cpus);
+
     // Vector to store worker threads
     std::vector<std::thread> threads_;
 
-    // Queue of tasks
-    std::queue<std::function<void()>> tasks_;
+    // Queues of tasks, one per priority
+    std::queue<std::function<void()>> tasks_[PRIORITY_COUNT];
+
+    // Total number of queued tasks
+    size_t pending_ = 0;
 
     // Mutex to synchronize access to shared data
     std::mutex queue_mutex_;
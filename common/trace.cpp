@@ -0,0 +1,206 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <chrono>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <algorithm>
+
+#include "trace.hpp"
+#include "parsing.hpp"
+
+static const char *PHASE_NAMES[PHASE_COUNT] = {"accept", "queue", "handshake", "read", "parse", "handler", "write", "log"};
+
+static TraceOptions options_;
+static std::atomic<uint64_t> request_counter{0};
+
+static int64_t now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Trace timestamps are relative to the process start
+static const int64_t epoch_ns = now_ns();
+
+// Per thread ring buffer. The owner thread only takes the (uncontended)
+// mutex for sampled requests, the exporter takes it to copy records out.
+struct ThreadBuffer
+{
+    int tid = 0;
+    std::string name;
+    std::mutex mutex;
+    std::vector<RequestTrace> records;
+    uint64_t written = 0;
+};
+
+// Buffers outlive their threads so a dump after shutdown still sees them
+static std::mutex registry_mutex;
+static std::vector<std::shared_ptr<ThreadBuffer>> registry;
+
+static ThreadBuffer &local_buffer()
+{
+    thread_local std::shared_ptr<ThreadBuffer> buffer = []
+    {
+        auto created = std::make_shared<ThreadBuffer>();
+        std::lock_guard<std::mutex> guard(registry_mutex);
+        created->tid = registry.size() + 1;
+        created->name = "thread " + std::to_string(created->tid);
+        registry.push_back(created);
+        return created;
+    }();
+    return *buffer;
+}
+
+void RequestTrace::start()
+{
+    marks[0] = now_ns();
+    if (options_.sample_every > 0)
+    {
+        id = request_counter.fetch_add(1, std::memory_order_relaxed) + 1;
+        sampled = id % options_.sample_every == 0;
+    }
+}
+
+void RequestTrace::mark_slow(TracePhase phase)
+{
+    marks[phase + 1] = now_ns();
+    threads[phase] = local_buffer().tid;
+}
+
+void RequestTrace::finish()
+{
+    if (!sampled)
+        return;
+
+    ThreadBuffer &buffer = local_buffer();
+    std::lock_guard<std::mutex> guard(buffer.mutex);
+    if (buffer.records.empty())
+        buffer.records.resize(std::max(1, options_.buffer_records));
+    buffer.records[buffer.written++ % buffer.records.size()] = *this;
+}
+
+double RequestTrace::elapsed_ms() const
+{
+    return (now_ns() - marks[0]) / 1e6;
+}
+
+void trace_configure(const TraceOptions &options)
+{
+    options_ = options;
+}
+
+const TraceOptions &trace_options()
+{
+    return options_;
+}
+
+void trace_thread_name(const std::string &name)
+{
+    ThreadBuffer &buffer = local_buffer();
+    std::lock_guard<std::mutex> guard(buffer.mutex);
+    buffer.name = name;
+}
+
+// One trace event, ts and dur in microseconds
+static void write_event(std::ostream &out, bool &first, const char *name, const char *ph, int tid,
+                        int64_t begin_ns, int64_t end_ns, uint64_t id)
+{
+    out << (first ? "\n" : ",\n");
+    first = false;
+    out << "{\"name\":\"" << name << "\",\"cat\":\"request\",\"ph\":\"" << ph << "\",\"pid\":1,\"tid\":" << tid
+        << ",\"ts\":" << (begin_ns - epoch_ns) / 1000.0;
+    if (ph[0] == 'X')
+        out << ",\"dur\":" << (end_ns - begin_ns) / 1000.0;
+    if (ph[0] == 'b' || ph[0] == 'e')
+        out << ",\"id\":" << id;
+    out << ",\"args\":{\"request\":" << id << "}}";
+}
+
+std::string trace_export_json()
+{
+    std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+    {
+        std::lock_guard<std::mutex> guard(registry_mutex);
+        buffers = registry;
+    }
+
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(3);
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    bool first = true;
+
+    for (auto &buffer : buffers)
+    {
+        std::vector<RequestTrace> records;
+        std::string name;
+        {
+            std::lock_guard<std::mutex> guard(buffer->mutex);
+            records = buffer->records;
+            name = buffer->name;
+            if (buffer->written < records.size())
+                records.resize(buffer->written);
+        }
+
+        out << (first ? "\n" : ",\n");
+        first = false;
+        out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->tid
+            << ",\"args\":{\"name\":\"" << name << "\"}}";
+
+        for (const auto &record : records)
+        {
+            // A phase starts at the previous mark that was taken, skipped phases have no mark
+            int64_t begin = record.marks[0];
+            for (int phase = 0; phase < PHASE_COUNT; phase++)
+            {
+                int64_t end = record.marks[phase + 1];
+                if (end == 0)
+                    continue;
+                if (phase == PHASE_QUEUE)
+                {
+                    // Waiting overlaps other requests on the same thread, async events keep it readable
+                    write_event(out, first, PHASE_NAMES[phase], "b", record.threads[phase], begin, end, record.id);
+                    write_event(out, first, PHASE_NAMES[phase], "e", record.threads[phase], end, end, record.id);
+                }
+                else
+                    write_event(out, first, PHASE_NAMES[phase], "X", record.threads[phase], begin, end, record.id);
+                begin = end;
+            }
+        }
+    }
+    out << "\n]}\n";
+    return out.str();
+}
+
+bool trace_dump()
+{
+    if (options_.sample_every <= 0)
+        return false;
+
+    std::ofstream file(options_.file);
+    if (!file)
+    {
+        perror((time_stamp() + " Trace file not created").c_str());
+        return false;
+    }
+    file << trace_export_json();
+    std::cout << time_stamp() << " Trace written to " << options_.file << std::endl;
+    return true;
+}
+
+bool parse_trace_option(const std::string &arg, TraceOptions &options)
+{
+    return parse_int_arg(arg, "--trace", options.sample_every) ||
+           parse_int_arg(arg, "--trace-buffer", options.buffer_records) ||
+           parse_string_arg(arg, "--trace-file", options.file);
+}
+
+std::string trace_options_usage()
+{
+    return "Trace options:\n"
+           "\t--trace=<n>\t\ttrace one of n requests (1: all), GET /trace returns the trace\n"
+           "\t--trace-buffer=<n>\trecords kept per thread\n"
+           "\t--trace-file=<path>\tChrome trace written on shutdown, default trace.json\n";
+}
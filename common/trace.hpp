@@ -0,0 +1,66 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+// Request phases, each one ends where the next one starts
+enum TracePhase
+{
+    PHASE_ACCEPT,    // accept() returned .. handed to a worker
+    PHASE_QUEUE,     // waiting in the worker queue
+    PHASE_HANDSHAKE, // TLS handshake
+    PHASE_READ,      // reading the request
+    PHASE_PARSE,     // splitting the request
+    PHASE_HANDLER,   // GET / POST handler
+    PHASE_WRITE,     // writing the response
+    PHASE_LOG,       // writing the log record
+    PHASE_COUNT
+};
+
+struct TraceOptions
+{
+    int sample_every = 0;         // Trace one of N requests, 0: tracing off
+    int buffer_records = 4096;    // Per thread ring buffer size
+    std::string file = "trace.json"; // Chrome trace written on shutdown
+};
+
+// Timestamps of one request. The start is always taken (the log duration is
+// measured from accept), phase marks only for sampled requests.
+class RequestTrace
+{
+public:
+    // Call right after accept()
+    void start();
+    // End of a phase, on the thread that did the work
+    inline void mark(TracePhase phase)
+    {
+        if (sampled)
+            mark_slow(phase);
+    }
+    // Copy the record into the calling thread's buffer
+    void finish();
+    // Milliseconds since start()
+    double elapsed_ms() const;
+
+    bool sampled = false;
+    uint64_t id = 0;
+    int64_t marks[PHASE_COUNT + 1] = {0}; // ns, marks[0] is the start
+    int threads[PHASE_COUNT] = {0};       // Trace thread id that did each phase
+
+private:
+    void mark_slow(TracePhase phase);
+};
+
+void trace_configure(const TraceOptions &options);
+const TraceOptions &trace_options();
+// Name shown for the calling thread in the trace viewer
+void trace_thread_name(const std::string &name);
+// All buffered records as Chrome trace-event JSON (chrome://tracing, Perfetto)
+std::string trace_export_json();
+// Write trace_export_json() to the configured file, false if tracing is off
+bool trace_dump();
+
+// Parse one command line argument like "--trace=100"
+bool parse_trace_option(const std::string &arg, TraceOptions &options);
+std::string trace_options_usage();
@@ -0,0 +1,220 @@
+#include "log_segment.hpp"
+#include "../common/parsing.hpp"
+
+#include <iostream>
+#include <fstream>
+#include <charconv>
+#include <algorithm>
+#include <cstdio>
+#include <ctime>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define INDEX_MAGIC "logstat-index 2"
+
+// Days since 1970-01-01 of a civil date (proleptic Gregorian)
+static int64_t days_from_civil(int64_t y, unsigned m, unsigned d)
+{
+    y -= m <= 2;
+    const int64_t era = (y >= 0 ? y : y - 399) / 400;
+    const unsigned yoe = (unsigned)(y - era * 400);
+    const unsigned doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + (int64_t)doe - 719468;
+}
+
+static bool digits(const char *p, int n, int &value)
+{
+    value = 0;
+    for (int i = 0; i < n; i++)
+    {
+        if (p[i] < '0' || p[i] > '9')
+            return false;
+        value = value * 10 + (p[i] - '0');
+    }
+    return true;
+}
+
+// "[2025-01-31 12:00:00.123]" as written by time_stamp()
+static bool parse_stamp(std::string_view line, int64_t &time_ms)
+{
+    if (line.size() < 25 || line[0] != '[' || line[5] != '-' || line[8] != '-' ||
+        line[11] != ' ' || line[14] != ':' || line[17] != ':' || line[20] != '.' || line[24] != ']')
+        return false;
+    const char *p = line.data();
+    int year, month, day, hour, minute, second, ms;
+    if (!digits(p + 1, 4, year) || !digits(p + 6, 2, month) || !digits(p + 9, 2, day) ||
+        !digits(p + 12, 2, hour) || !digits(p + 15, 2, minute) || !digits(p + 18, 2, second) ||
+        !digits(p + 21, 3, ms))
+        return false;
+    time_ms = ((days_from_civil(year, month, day) * 24 + hour) * 60 + minute) * 60000LL + second * 1000LL + ms;
+    return true;
+}
+
+// Number after name, the line is not terminated so from_chars keeps within it
+template <typename T>
+static bool field(std::string_view line, std::string_view name, size_t from, T &value)
+{
+    size_t at = line.find(name, from);
+    if (at == std::string_view::npos)
+        return false;
+    const char *begin = line.data() + at + name.size();
+    return std::from_chars(begin, line.data() + line.size(), value).ec == std::errc();
+}
+
+bool parse_record(std::string_view line, LogRecord &record)
+{
+    static const std::string_view client = " Client ";
+    if (!parse_stamp(line, record.time_ms) || line.compare(25, client.size(), client) != 0)
+        return false;
+
+    size_t begin = 25 + client.size();
+    size_t end = line.find(' ', begin);
+    if (end == std::string_view::npos)
+        return false;
+    std::string_view address = line.substr(begin, end - begin);
+    size_t port = address.rfind(':');
+    record.client = port == std::string_view::npos ? address : address.substr(0, port);
+
+    return field(line, "status: ", end, record.status) &&
+           field(line, "duration: ", end, record.duration_ms);
+}
+
+bool parse_time_arg(const std::string &text, int64_t &time_ms)
+{
+    int year = 0, month = 0, day = 0, hour = 0, minute = 0, second = 0;
+    char separator = ' ';
+    int fields = sscanf(text.c_str(), "%4d-%2d-%2d%c%2d:%2d:%2d", &year, &month, &day, &separator, &hour, &minute, &second);
+    if (fields < 3 || (fields > 3 && separator != ' ' && separator != 'T') || fields == 4 ||
+        month < 1 || month > 12 || day < 1 || day > 31 || hour > 23 || minute > 59 || second > 60)
+    {
+        std::cerr << time_stamp() << " Bad time: " << text << ", expected YYYY-MM-DD[ HH:MM[:SS]]" << std::endl;
+        return false;
+    }
+    time_ms = ((days_from_civil(year, month, day) * 24 + hour) * 60 + minute) * 60000LL + second * 1000LL;
+    return true;
+}
+
+std::string format_time(int64_t time_ms)
+{
+    time_t seconds = (time_t)(time_ms / 1000);
+    struct tm tm;
+    gmtime_r(&seconds, &tm);
+    char buffer[32];
+    strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", &tm);
+    return buffer;
+}
+
+MappedFile::MappedFile(const std::string &path)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        perror((time_stamp() + " Open " + path + " failed").c_str());
+        return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0)
+    {
+        perror((time_stamp() + " Stat " + path + " failed").c_str());
+        close(fd);
+        return;
+    }
+    size_ = (uint64_t)st.st_size;
+    mtime_ns_ = (int64_t)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+    if (size_ > 0)
+    {
+        void *data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED)
+        {
+            perror((time_stamp() + " Mmap " + path + " failed").c_str());
+            close(fd);
+            return;
+        }
+        // Read once front to back: large readahead, pages dropped behind
+        madvise(data, size_, MADV_SEQUENTIAL);
+        data_ = (const char *)data;
+    }
+    close(fd); // The mapping keeps the file
+    opened_ = true;
+}
+
+MappedFile::~MappedFile()
+{
+    if (data_ != nullptr)
+        munmap((void *)data_, size_);
+}
+
+bool SegmentIndex::load(const std::string &path)
+{
+    std::ifstream in(path);
+    std::string magic;
+    size_t count = 0;
+    if (!std::getline(in, magic) || magic != INDEX_MAGIC ||
+        !(in >> size >> mtime_ns >> records >> first_ms >> last_ms >> count))
+        return false;
+    blocks.resize(count);
+    for (Block &block : blocks)
+        if (!(in >> block.offset >> block.first_ms >> block.last_ms))
+            return false;
+    return true;
+}
+
+bool SegmentIndex::save(const std::string &path) const
+{
+    // Written aside and renamed, a concurrent reader sees the old or the new index
+    const std::string temp = path + ".tmp";
+    {
+        std::ofstream out(temp, std::ios::trunc);
+        out << INDEX_MAGIC << "\n"
+            << size << " " << mtime_ns << " " << records << " " << first_ms << " " << last_ms << " "
+            << blocks.size() << "\n";
+        for (const Block &block : blocks)
+            out << block.offset << " " << block.first_ms << " " << block.last_ms << "\n";
+        if (!out.flush())
+        {
+            std::cerr << time_stamp() << " Cannot write index " << temp << std::endl;
+            unlink(temp.c_str());
+            return false;
+        }
+    }
+    if (rename(temp.c_str(), path.c_str()) < 0)
+    {
+        perror((time_stamp() + " Rename " + temp + " failed").c_str());
+        unlink(temp.c_str());
+        return false;
+    }
+    return true;
+}
+
+std::vector<std::pair<uint64_t, uint64_t>> SegmentIndex::ranges(int64_t from_ms, int64_t to_ms) const
+{
+    std::vector<std::pair<uint64_t, uint64_t>> result;
+    for (size_t i = 0; i < blocks.size(); i++)
+    {
+        if (blocks[i].last_ms < from_ms || blocks[i].first_ms > to_ms)
+            continue;
+        uint64_t end = i + 1 < blocks.size() ? blocks[i + 1].offset : size;
+        if (!result.empty() && result.back().second == blocks[i].offset)
+            result.back().second = end;
+        else
+            result.emplace_back(blocks[i].offset, end);
+    }
+    return result;
+}
+
+void SegmentIndex::add(int64_t time_ms, uint64_t offset)
+{
+    if (records == 0)
+        first_ms = last_ms = time_ms;
+    first_ms = std::min(first_ms, time_ms);
+    last_ms = std::max(last_ms, time_ms);
+    if (blocks.empty() || offset >= blocks.size() * INDEX_STEP)
+        blocks.push_back({offset, time_ms, time_ms});
+    Block &block = blocks.back();
+    block.first_ms = std::min(block.first_ms, time_ms);
+    block.last_ms = std::max(block.last_ms, time_ms);
+    records++;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <utility>
+#include <cstdint>
+#include <cstddef>
+
+// One response record of the server log:
+// [2025-01-31 12:00:00.123] Client 10.0.0.1:51234 status: 200 duration: 1.25 ms
+// The request lines after it start with the time stamp and a tab.
+struct LogRecord
+{
+    int64_t time_ms = 0;     // UTC, ms since the epoch
+    std::string_view client; // Address without the port
+    int status = 0;
+    double duration_ms = 0;
+};
+
+// Parse a line, false for request lines and anything else
+bool parse_record(std::string_view line, LogRecord &record);
+// "2025-01-31", "2025-01-31 12:00", "2025-01-31T12:00:00" (UTC) to ms since the epoch
+bool parse_time_arg(const std::string &text, int64_t &time_ms);
+std::string format_time(int64_t time_ms);
+
+// Read-only memory map of a log segment
+class MappedFile
+{
+public:
+    explicit MappedFile(const std::string &path);
+    ~MappedFile();
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    bool ok() const { return opened_; }
+    std::string_view data() const { return {data_, size_}; }
+    uint64_t size() const { return size_; }
+    int64_t mtime_ns() const { return mtime_ns_; }
+
+private:
+    const char *data_ = nullptr;
+    uint64_t size_ = 0;
+    int64_t mtime_ns_ = 0;
+    bool opened_ = false;
+};
+
+// Sidecar index of a segment, <segment>.idx. Valid while the segment keeps
+// its size and modification time; the segment being written is re-indexed.
+struct SegmentIndex
+{
+    // Records whose line starts in [offset, next block's offset), about INDEX_STEP bytes
+    struct Block
+    {
+        uint64_t offset = 0;
+        int64_t first_ms = 0; // Earliest and latest record, the order inside a block does not matter
+        int64_t last_ms = 0;
+    };
+
+    uint64_t size = 0;
+    int64_t mtime_ns = 0;
+    size_t records = 0;
+    int64_t first_ms = 0;
+    int64_t last_ms = 0;
+    std::vector<Block> blocks;
+
+    static const uint64_t INDEX_STEP = 64 * 1024;
+
+    bool load(const std::string &path);
+    bool save(const std::string &path) const;
+    bool matches(const MappedFile &file) const { return size == file.size() && mtime_ns == file.mtime_ns(); }
+    bool overlaps(int64_t from_ms, int64_t to_ms) const { return records > 0 && first_ms <= to_ms && last_ms >= from_ms; }
+    // Byte ranges holding all records in [from_ms, to_ms], adjacent blocks merged
+    std::vector<std::pair<uint64_t, uint64_t>> ranges(int64_t from_ms, int64_t to_ms) const;
+    // Add a record while the segment is read from the start
+    void add(int64_t time_ms, uint64_t offset);
+};
@@ -0,0 +1,295 @@
+// Log statistics of the HTTPS server
+// (C) Anatoly Mazkun, buy me a beer, 2025
+//
+// Maps the rotated logs (server_log_NNN.txt) and parses the segments in
+// parallel, one thread per core. Every segment gets a sidecar index
+// (server_log_NNN.txt.idx) with the time range of every 64 KB block, so a
+// query for a time window skips the segments and blocks outside it.
+// Reports request rates, status mix, per client counts and duration
+// percentiles.
+//
+//   ./logstat --dir=../HTTPS/build --from="2025-01-31 12:00" --to="2025-01-31 13:00"
+
+#include "log_segment.hpp"
+#include "../common/cpu_topology.hpp"
+#include "../common/parsing.hpp"
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <limits>
+#include <filesystem>
+
+struct LogstatOptions
+{
+    std::string dir = "."; // Where the server_log_NNN.txt files are
+    std::string from;      // Window start, inclusive
+    std::string to;        // Window end, exclusive
+    int threads = 0;       // 0: CPUs available to the process
+    int top = 10;          // Clients listed
+    int interval = 0;      // Seconds per line of the rate table, 0: no table
+    bool reindex = false;  // Ignore the sidecar indexes and write them again
+};
+
+// Counters of one thread, merged at the end
+struct Stats
+{
+    size_t segments = 0; // Read, or partly read
+    size_t skipped = 0;  // Outside the window by their index
+    size_t indexed = 0;  // Index written
+    uint64_t bytes = 0;  // Scanned
+    size_t records = 0;
+    int64_t first_ms = std::numeric_limits<int64_t>::max();
+    int64_t last_ms = std::numeric_limits<int64_t>::min();
+    std::map<int, size_t> status;
+    std::unordered_map<std::string, size_t> clients;
+    std::unordered_map<int64_t, size_t> seconds; // Requests per second of the epoch
+    std::vector<float> durations;
+
+    void add(const LogRecord &record)
+    {
+        records++;
+        first_ms = std::min(first_ms, record.time_ms);
+        last_ms = std::max(last_ms, record.time_ms);
+        status[record.status]++;
+        clients[std::string(record.client)]++;
+        seconds[record.time_ms / 1000]++;
+        durations.push_back((float)record.duration_ms);
+    }
+
+    void merge(Stats &other)
+    {
+        segments += other.segments;
+        skipped += other.skipped;
+        indexed += other.indexed;
+        bytes += other.bytes;
+        records += other.records;
+        first_ms = std::min(first_ms, other.first_ms);
+        last_ms = std::max(last_ms, other.last_ms);
+        for (const auto &[code, count] : other.status)
+            status[code] += count;
+        for (const auto &[client, count] : other.clients)
+            clients[client] += count;
+        for (const auto &[second, count] : other.seconds)
+            seconds[second] += count;
+        durations.insert(durations.end(), other.durations.begin(), other.durations.end());
+        std::vector<float>().swap(other.durations);
+    }
+};
+
+static bool is_segment(const std::string &name)
+{
+    const std::string prefix = "server_log_", suffix = ".txt";
+    return name.size() > prefix.size() + suffix.size() &&
+           name.compare(0, prefix.size(), prefix) == 0 &&
+           name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+static std::vector<std::string> find_segments(const std::string &dir)
+{
+    std::vector<std::string> segments;
+    std::error_code error;
+    for (const auto &entry : std::filesystem::directory_iterator(dir, error))
+        if (entry.is_regular_file() && is_segment(entry.path().filename().string()))
+            segments.push_back(entry.path().string());
+    if (error)
+        std::cerr << time_stamp() << " Cannot list " << dir << ": " << error.message() << std::endl;
+    std::sort(segments.begin(), segments.end());
+    return segments;
+}
+
+// Records of one segment in [from_ms, to_ms) into stats
+static void scan_segment(const std::string &path, const LogstatOptions &options, int64_t from_ms, int64_t to_ms, Stats &stats)
+{
+    MappedFile file(path);
+    if (!file.ok())
+        return;
+
+    const std::string index_path = path + ".idx";
+    SegmentIndex index;
+    bool indexed = !options.reindex && index.load(index_path) && index.matches(file);
+    if (indexed && !index.overlaps(from_ms, to_ms - 1))
+    {
+        stats.skipped++;
+        return;
+    }
+
+    // Without a valid index the whole segment is read and indexed on the way
+    SegmentIndex built;
+    built.size = file.size();
+    built.mtime_ns = file.mtime_ns();
+
+    // Only the blocks whose time range meets the window
+    std::string_view data = file.data();
+    std::vector<std::pair<uint64_t, uint64_t>> ranges;
+    if (indexed)
+        ranges = index.ranges(from_ms, to_ms - 1);
+    else
+        ranges.emplace_back(0, data.size());
+
+    LogRecord record;
+    for (const auto &[begin, range_end] : ranges)
+    {
+        size_t offset = begin;
+        while (offset < range_end)
+        {
+            size_t end = data.find('\n', offset);
+            if (end == std::string_view::npos)
+                break; // Line still being written
+            std::string_view line = data.substr(offset, end - offset);
+            size_t line_offset = offset;
+            offset = end + 1;
+
+            if (!parse_record(line, record))
+                continue;
+            if (!indexed)
+                built.add(record.time_ms, line_offset);
+            if (record.time_ms >= from_ms && record.time_ms < to_ms)
+                stats.add(record);
+        }
+        stats.bytes += offset - begin;
+    }
+
+    stats.segments++;
+    if (!indexed && built.save(index_path))
+        stats.indexed++;
+}
+
+static std::string percent(size_t count, size_t total)
+{
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(1) << (total ? 100.0 * count / total : 0.0) << "%";
+    return out.str();
+}
+
+static void report(Stats &stats, const LogstatOptions &options, double elapsed)
+{
+    std::cout << "Segments: " << stats.segments << " read, " << stats.skipped << " skipped by index, "
+              << stats.indexed << " indexed, " << std::fixed << std::setprecision(1) << stats.bytes / 1e6
+              << " MB in " << std::setprecision(3) << elapsed << " s" << std::endl;
+    if (stats.records == 0)
+    {
+        std::cout << "No requests" << std::endl;
+        return;
+    }
+
+    double span = std::max(1.0, (stats.last_ms - stats.first_ms) / 1000.0);
+    auto peak = std::max_element(stats.seconds.begin(), stats.seconds.end(),
+                                 [](const auto &a, const auto &b)
+                                 { return a.second < b.second || (a.second == b.second && a.first > b.first); });
+    std::cout << "Requests: " << stats.records << " from " << format_time(stats.first_ms)
+              << " to " << format_time(stats.last_ms) << " UTC" << std::endl;
+    std::cout << "Rate: " << std::setprecision(1) << stats.records / span << " req/s average, "
+              << peak->second << " req/s peak at " << format_time(peak->first * 1000) << std::endl;
+
+    std::cout << "Status:" << std::endl;
+    for (const auto &[code, count] : stats.status)
+        std::cout << "  " << code << "  " << std::setw(10) << count << "  " << percent(count, stats.records) << std::endl;
+
+    std::sort(stats.durations.begin(), stats.durations.end());
+    auto quantile = [&](double q)
+    { return stats.durations[std::min(stats.durations.size() - 1, (size_t)(q * stats.durations.size()))]; };
+    std::cout << "Duration ms: " << std::setprecision(3) << "p50 " << quantile(0.5) << "  p90 " << quantile(0.9)
+              << "  p99 " << quantile(0.99) << "  p99.9 " << quantile(0.999) << "  max " << stats.durations.back() << std::endl;
+
+    std::vector<std::pair<std::string, size_t>> clients(stats.clients.begin(), stats.clients.end());
+    size_t top = std::min(clients.size(), (size_t)std::max(0, options.top));
+    std::partial_sort(clients.begin(), clients.begin() + top, clients.end(),
+                      [](const auto &a, const auto &b)
+                      { return a.second > b.second || (a.second == b.second && a.first < b.first); });
+    std::cout << "Clients: " << clients.size() << std::endl;
+    for (size_t i = 0; i < top; i++)
+        std::cout << "  " << std::left << std::setw(40) << clients[i].first << std::right << std::setw(10)
+                  << clients[i].second << "  " << percent(clients[i].second, stats.records) << std::endl;
+
+    if (options.interval > 0)
+    {
+        std::map<int64_t, size_t> intervals;
+        for (const auto &[second, count] : stats.seconds)
+            intervals[second - second % options.interval] += count;
+        std::cout << "Rate per " << options.interval << " s:" << std::endl;
+        for (const auto &[start, count] : intervals)
+            std::cout << "  " << format_time(start * 1000) << "  " << std::setw(10) << count << "  "
+                      << std::setprecision(1) << (double)count / options.interval << " req/s" << std::endl;
+    }
+}
+
+static bool parse_logstat_option(const std::string &arg, LogstatOptions &options)
+{
+    if (arg == "--reindex")
+        return options.reindex = true;
+    return parse_string_arg(arg, "--dir", options.dir) ||
+           parse_string_arg(arg, "--from", options.from) ||
+           parse_string_arg(arg, "--to", options.to) ||
+           parse_int_arg(arg, "--threads", options.threads) ||
+           parse_int_arg(arg, "--top", options.top) ||
+           parse_int_arg(arg, "--interval", options.interval);
+}
+
+static std::string logstat_options_usage()
+{
+    return "Usage: logstat [options]\n"
+           "\t--dir=<path>\t\tfolder of the server_log_NNN.txt files, default: .\n"
+           "\t--from=<time>\t\twindow start, UTC: YYYY-MM-DD[ HH:MM[:SS]]\n"
+           "\t--to=<time>\t\twindow end, exclusive\n"
+           "\t--threads=<n>\t\tparser threads, default: available cores\n"
+           "\t--top=<n>\t\tclients listed, default: 10\n"
+           "\t--interval=<sec>\tprint the request rate per interval\n"
+           "\t--reindex\t\trebuild the sidecar indexes (server_log_NNN.txt.idx)\n";
+}
+
+int main(int argc, char *argv[])
+{
+    LogstatOptions options;
+    for (int i = 1; i < argc; i++)
+    {
+        if (!parse_logstat_option(argv[i], options))
+        {
+            std::cerr << "Unknown option " << argv[i] << "\n" << logstat_options_usage();
+            return 1;
+        }
+    }
+
+    int64_t from_ms = std::numeric_limits<int64_t>::min();
+    int64_t to_ms = std::numeric_limits<int64_t>::max();
+    if ((!options.from.empty() && !parse_time_arg(options.from, from_ms)) ||
+        (!options.to.empty() && !parse_time_arg(options.to, to_ms)))
+        return 1;
+
+    std::vector<std::string> segments = find_segments(options.dir);
+    if (segments.empty())
+    {
+        std::cerr << time_stamp() << " No server_log_NNN.txt in " << options.dir << std::endl;
+        return 1;
+    }
+
+    // Segments are about the same size (LOG_MAX_SIZE), threads take the next one
+    size_t threads = options.threads > 0 ? options.threads : default_worker_count();
+    threads = std::max<size_t>(1, std::min(threads, segments.size()));
+    std::vector<Stats> stats(threads);
+    std::atomic<size_t> next{0};
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < threads; t++)
+        workers.emplace_back([&, t]
+                             {
+            for (size_t i; (i = next.fetch_add(1)) < segments.size();)
+                scan_segment(segments[i], options, from_ms, to_ms, stats[t]); });
+    for (auto &worker : workers)
+        worker.join();
+    for (size_t t = 1; t < threads; t++)
+        stats[0].merge(stats[t]);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    report(stats[0], options, elapsed.count());
+    return 0;
+}